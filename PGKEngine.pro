@@ -10,35 +10,47 @@ DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs depr
 
 SOURCES += \
     main.cpp \
+    pgk_assets.cpp \
+    pgk_bvh.cpp \
     pgk_camera.cpp \
     pgk_core.cpp \
     pgk_draw.cpp \
     pgk_engine.cpp \
     pgk_gameobject.cpp \
     pgk_input.cpp \
+    pgk_jobsystem.cpp \
     pgk_launcher.cpp \
     pgk_light.cpp \
     pgk_math.cpp \
     pgk_obj.cpp \
+    pgk_occlusion.cpp \
     pgk_raycast.cpp \
     pgk_rigidbody.cpp \
     pgk_scene.cpp \
+    pgk_shadowmap.cpp \
+    pgk_simplify.cpp \
     pgk_view.cpp
 
 HEADERS += \
+    pgk_assets.h \
+    pgk_bvh.h \
     pgk_camera.h \
     pgk_core.h \
     pgk_draw.h \
     pgk_engine.h \
     pgk_gameobject.h \
     pgk_input.h \
+    pgk_jobsystem.h \
     pgk_launcher.h \
     pgk_light.h \
     pgk_math.h \
     pgk_obj.h \
+    pgk_occlusion.h \
     pgk_raycast.h \
     pgk_rigidbody.h \
     pgk_scene.h \
+    pgk_shadowmap.h \
+    pgk_simplify.h \
     pgk_view.h
 
 # remove other opt flags
@@ -56,7 +68,11 @@ QMAKE_CXXFLAGS_RELEASE *= -O3
 QMAKE_CXXFLAGS_DEBUG *= -Wall
 QMAKE_CXXFLAGS_DEBUG *= -Wextra
 QMAKE_CXXFLAGS_RELEASE *= -ffast-math
-QMAKE_CXXFLAGS_RELEASE *= -msse4.1
+# SimdFloat in pgk_math.h blends with SSE4.1 when it is enabled, in every configuration
+!msvc: QMAKE_CXXFLAGS *= -msse4.1
+# rasterize 8 pixels per step instead of 4 (SimdFloat in pgk_math.h)
+# !msvc: QMAKE_CXXFLAGS *= -mavx2
+# msvc: QMAKE_CXXFLAGS *= /arch:AVX2
 # Default rules for deployment.
 qnx: target.path = /tmp/$${TARGET}/bin
 else: unix:!android: target.path = /opt/$${TARGET}/bin
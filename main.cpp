@@ -3,6 +3,7 @@
 #include "pgk_core.h"
 #include "pgk_scene.h"
 #include "pgk_engine.h"
+#include "pgk_draw.h"
 
 #include <QApplication>
 #include <thread>
@@ -15,6 +16,7 @@ int main(int argc, char *argv[]) {
     if (launcher.exec() == QDialog::Accepted) {
         QString scenePath = launcher.getCoreSettings();
         g_pgkCore.AVAILABLE_THREADS = std::thread::hardware_concurrency();
+        PGK_Engine::startJobSystem();
         PGK_View view(nullptr);
         if (g_pgkCore.WINDOWED) {
             view.show();
@@ -23,10 +25,21 @@ int main(int argc, char *argv[]) {
         }
         view.lockMouse();
 
-        PGK_Scene scene(scenePath);
-        PGK_Engine engine(&scene,&view);
-
-        return a.exec();
+        int result;
+        {
+            // the view is shown already, so it can report the loading progress
+            PGK_Scene scene(scenePath, [&view](size_t loaded, size_t total) {
+                view.canvas.fill(Qt::black);
+                PGK_Draw::drawText(view.canvas, "Loading: " + QString::number(loaded) + "/" + QString::number(total), 10, 10, 20, Qt::white);
+                view.repaint();
+            });
+            PGK_Engine engine(&scene,&view);
+
+            result = a.exec();
+        }
+        // the scene waits for its load tasks, the workers have to outlive it to run them
+        PGK_Engine::stopJobSystem();
+        return result;
 
     }
 
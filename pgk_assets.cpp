@@ -0,0 +1,121 @@
+#include "pgk_assets.h"
+
+#include <QFileInfo>
+
+// loads the calling thread is inside of
+static thread_local int t_loadDepth = 0;
+
+std::string PGK_AssetManager::canonicalPath(const std::string &path)
+{
+    const QFileInfo info(QString::fromStdString(path));
+    const QString canonical = info.canonicalFilePath();
+    return (canonical.isEmpty() ? info.absoluteFilePath() : canonical).toStdString();
+}
+
+// the arrays of a mesh or level of detail, without its bvh
+static size_t meshBytes(const Mesh &mesh)
+{
+    return mesh.vertices.capacity() * sizeof(Vertex) + mesh.indices.capacity() * sizeof(unsigned int)
+         + (mesh.tangents.capacity() + mesh.bitangents.capacity()) * sizeof(Vec3)
+         + mesh.clusters.capacity() * sizeof(MeshCluster) + mesh.clusterVertices.capacity() * sizeof(unsigned int);
+}
+
+PGK_AssetManager &PGK_AssetManager::instance()
+{
+    static PGK_AssetManager instance;
+    return instance;
+}
+
+template <typename T>
+std::shared_ptr<const T> PGK_AssetManager::getOrLoad(EntryMap<T> &entries, const std::string &key, const std::function<std::shared_ptr<const T>()> &load)
+{
+    std::promise<std::shared_ptr<const T>> loaded;
+    std::shared_future<std::shared_ptr<const T>> inFlight;
+    bool publish = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Entry<T> &entry = entries[key];
+        if (std::shared_ptr<const T> asset = entry.asset.lock())
+            return asset;
+        if (!entry.loading.valid())
+        {
+            entry.loading = loaded.get_future().share();
+            publish = true;
+        }
+        else if (t_loadDepth == 0)
+        {
+            inFlight = entry.loading;
+        }
+        // else a load further up this thread's stack may be the one in flight, waiting for it would
+        // deadlock so this loads a copy of its own. loads don't request other assets and the job
+        // system never starts a load inside another, so this is only a guard
+    }
+    if (inFlight.valid())
+        return inFlight.get();
+
+    t_loadDepth++;
+    std::shared_ptr<const T> asset = load();
+    t_loadDepth--;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Entry<T> &entry = entries[key];
+        if (!entry.asset.lock())
+            entry.asset = asset;
+        if (publish)
+            entry.loading = {};
+    }
+    loaded.set_value(asset);
+    return asset;
+}
+
+PGK_AssetManager::MeshHandle PGK_AssetManager::getMeshes(const std::string &path)
+{
+    return getOrLoad<std::vector<Mesh>>(meshes, canonicalPath(path), [&]()
+                                        { return std::make_shared<const std::vector<Mesh>>(ObjLoader::loadObj(path)); });
+}
+
+PGK_AssetManager::TextureHandle PGK_AssetManager::getTexture(const std::string &path)
+{
+    return getOrLoad<QImage>(textures, canonicalPath(path), [&]()
+                             {
+        auto image = std::make_shared<const QImage>(QString::fromStdString(path));
+        return image->isNull() ? TextureHandle() : TextureHandle(image); });
+}
+
+template <typename T>
+std::vector<std::shared_ptr<const T>> PGK_AssetManager::liveAssets(const EntryMap<T> &entries)
+{
+    std::vector<std::shared_ptr<const T>> assets;
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto &entry : entries)
+    {
+        if (std::shared_ptr<const T> asset = entry.second.asset.lock())
+            assets.push_back(asset);
+    }
+    return assets;
+}
+
+PGK_AssetManager::Footprint PGK_AssetManager::getFootprint()
+{
+    Footprint footprint;
+    for (const MeshHandle &asset : liveAssets<std::vector<Mesh>>(meshes))
+    {
+        footprint.meshCount++;
+        for (const Mesh &mesh : *asset)
+        {
+            footprint.meshBytes += meshBytes(mesh);
+            for (const Mesh &lod : mesh.lods)
+            {
+                footprint.meshBytes += meshBytes(lod);
+            }
+            if (mesh.bvh)
+                footprint.meshBytes += mesh.bvh->getMemoryUsage();
+        }
+    }
+    for (const TextureHandle &asset : liveAssets<QImage>(textures))
+    {
+        footprint.textureCount++;
+        footprint.textureBytes += asset->sizeInBytes();
+    }
+    return footprint;
+}
@@ -0,0 +1,69 @@
+#ifndef PGK_ASSETS_H
+#define PGK_ASSETS_H
+
+#include "pgk_obj.h"
+
+#include <QImage>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// hands out shared, immutable meshes and textures keyed by canonical file path. the cache only
+// holds weak references, an asset is freed with its last user and loaded again when needed
+class PGK_AssetManager
+{
+public:
+    typedef std::shared_ptr<const std::vector<Mesh>> MeshHandle;
+    typedef std::shared_ptr<const QImage> TextureHandle;
+
+    // assets that are currently alive
+    struct Footprint
+    {
+        size_t meshCount = 0;
+        size_t meshBytes = 0;
+        size_t textureCount = 0;
+        size_t textureBytes = 0;
+    };
+
+    static PGK_AssetManager &instance();
+
+    // the key an asset file is cached under, absolute when the file doesn't exist
+    static std::string canonicalPath(const std::string &path);
+
+    // texture overrides are applied by the objects (PGK_GameObject::setTexture), so every user of
+    // a file shares one copy of its meshes
+    MeshHandle getMeshes(const std::string &path);
+    // null when the image could not be loaded
+    TextureHandle getTexture(const std::string &path);
+
+    Footprint getFootprint();
+
+private:
+    PGK_AssetManager() = default;
+
+    // loading is set while a load runs, concurrent requests for the asset wait on it instead of
+    // loading it twice. both are guarded by mutex, which is never held across a load
+    template <typename T>
+    struct Entry
+    {
+        std::weak_ptr<const T> asset;
+        std::shared_future<std::shared_ptr<const T>> loading;
+    };
+    template <typename T>
+    using EntryMap = std::unordered_map<std::string, Entry<T>>;
+
+    template <typename T>
+    std::shared_ptr<const T> getOrLoad(EntryMap<T> &entries, const std::string &key, const std::function<std::shared_ptr<const T>()> &load);
+    // every asset of entries that is still alive
+    template <typename T>
+    std::vector<std::shared_ptr<const T>> liveAssets(const EntryMap<T> &entries);
+
+    std::mutex mutex;
+    EntryMap<std::vector<Mesh>> meshes;
+    EntryMap<QImage> textures;
+};
+
+#endif // PGK_ASSETS_H
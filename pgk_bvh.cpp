@@ -0,0 +1,482 @@
+#include "pgk_bvh.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+void PGK_BVH::Bounds::grow(const Vec3 &point)
+{
+    min = Vec3(std::min(min.x, point.x), std::min(min.y, point.y), std::min(min.z, point.z));
+    max = Vec3(std::max(max.x, point.x), std::max(max.y, point.y), std::max(max.z, point.z));
+}
+
+void PGK_BVH::Bounds::grow(const Bounds &bounds)
+{
+    grow(bounds.min);
+    grow(bounds.max);
+}
+
+float PGK_BVH::Bounds::area() const
+{
+    const Vec3 extent = max - min;
+    if (extent.x < 0)
+        return 0; // empty
+    return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+}
+
+void PGK_BVH::build(const Triangles &triangles)
+{
+    triangleCount = triangles.count;
+    nodes.clear();
+    nodesUsed = 0;
+    builtArea = 0;
+    if (triangleCount == 0)
+        return;
+
+    primitives.resize(triangleCount);
+    centroids.resize(triangleCount);
+    for (uint32_t i = 0; i < triangleCount; ++i)
+    {
+        primitives[i] = i;
+        centroids[i] = (triangles.corner(i, 0) + triangles.corner(i, 1) + triangles.corner(i, 2)) / 3.0f;
+    }
+
+    // a binary tree with one triangle per leaf is the worst case
+    nodes.resize(triangleCount * 2);
+    nodesUsed = 1;
+
+    // large subtrees are handed to the job system, every job writes its own primitive range
+    // and allocates its nodes from nodesUsed
+    PGK_JobSystem::Counter counter;
+    buildNode(triangles, 0, 0, triangleCount, 0, counter);
+    PGK_JobSystem::instance().wait(counter);
+
+    // the worst case reserved about twice the nodes a tree with several triangles per leaf needs
+    nodes.resize(nodesUsed);
+    nodes.shrink_to_fit();
+    std::vector<Vec3>().swap(centroids);
+    builtArea = totalArea();
+}
+
+void PGK_BVH::refit(const Triangles &triangles)
+{
+    // children are always allocated after their parent
+    for (size_t i = nodes.size(); i-- > 0;)
+    {
+        Node &node = nodes[i];
+        node.bounds = Bounds();
+        if (node.count > 0)
+        {
+            for (uint32_t p = node.first; p < node.first + node.count; ++p)
+            {
+                node.bounds.grow(triangleBounds(triangles, primitives[p]));
+            }
+        }
+        else
+        {
+            node.bounds.grow(nodes[node.first].bounds);
+            node.bounds.grow(nodes[node.first + 1].bounds);
+        }
+    }
+}
+
+void PGK_BVH::update(const Triangles &triangles)
+{
+    if (isEmpty() || triangles.count != triangleCount)
+    {
+        build(triangles);
+        return;
+    }
+
+    refit(triangles);
+    // refitting keeps the topology, rebuild once the nodes have grown too loose
+    if (totalArea() > builtArea * 1.5f)
+        build(triangles);
+}
+
+void PGK_BVH::serialize(std::vector<char> &data) const
+{
+    // node count, the nodes, then one primitive per triangle
+    const uint32_t nodeCount = static_cast<uint32_t>(nodes.size());
+    const size_t offset = data.size();
+    data.resize(offset + sizeof(nodeCount) + nodes.size() * sizeof(Node) + primitives.size() * sizeof(uint32_t));
+    char *out = data.data() + offset;
+    std::memcpy(out, &nodeCount, sizeof(nodeCount));
+    out += sizeof(nodeCount);
+    std::memcpy(out, nodes.data(), nodes.size() * sizeof(Node));
+    out += nodes.size() * sizeof(Node);
+    std::memcpy(out, primitives.data(), primitives.size() * sizeof(uint32_t));
+}
+
+bool PGK_BVH::deserialize(const Triangles &triangles, const char *data, size_t size)
+{
+    const size_t count = triangles.count;
+    uint32_t nodeCount;
+    if (size < sizeof(nodeCount))
+        return false;
+    std::memcpy(&nodeCount, data, sizeof(nodeCount));
+    if (size != sizeof(nodeCount) + nodeCount * sizeof(Node) + count * sizeof(uint32_t) || (nodeCount == 0) != (count == 0))
+        return false;
+
+    std::vector<Node> loadedNodes(nodeCount);
+    std::vector<uint32_t> loadedPrimitives(count);
+    std::memcpy(loadedNodes.data(), data + sizeof(nodeCount), nodeCount * sizeof(Node));
+    std::memcpy(loadedPrimitives.data(), data + sizeof(nodeCount) + nodeCount * sizeof(Node), count * sizeof(uint32_t));
+
+    // the traversal trusts the tree, so it has to be one
+    for (uint32_t i = 0; i < nodeCount; ++i)
+    {
+        const Node &node = loadedNodes[i];
+        if (node.count > 0 ? node.first > count || node.count > count - node.first
+                           : node.first <= i || node.first >= nodeCount - 1)
+            return false;
+    }
+    for (const uint32_t primitive : loadedPrimitives)
+    {
+        if (primitive >= count)
+            return false;
+    }
+
+    triangleCount = count;
+    nodes = std::move(loadedNodes);
+    primitives = std::move(loadedPrimitives);
+    nodesUsed = nodeCount;
+    builtArea = totalArea();
+    return true;
+}
+
+size_t PGK_BVH::getMemoryUsage() const
+{
+    return nodes.capacity() * sizeof(Node) + primitives.capacity() * sizeof(uint32_t) + centroids.capacity() * sizeof(Vec3);
+}
+
+bool PGK_BVH::anyHit(const Triangles &triangles, const Vec3 &origin, const Vec3 &direction, float maxT) const
+{
+    return anyHit(triangles, origin, direction, maxT, Sphere(), [](uint32_t) { return true; });
+}
+
+bool PGK_BVH::closestHit(const Triangles &triangles, const Vec3 &origin, const Vec3 &direction, float maxT, Hit &hit) const
+{
+    if (isEmpty())
+        return false;
+
+    const Ray ray = makeRay(origin, direction);
+    uint32_t stack[STACK_SIZE];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+    bool found = false;
+    float t;
+
+    while (stackSize > 0)
+    {
+        const Node &node = nodes[stack[--stackSize]];
+        if (!intersectBounds(node.bounds, ray, maxT))
+            continue;
+
+        if (node.count > 0)
+        {
+            for (uint32_t i = node.first; i < node.first + node.count; ++i)
+            {
+                const uint32_t triangle = primitives[i];
+                if (PGK_Math::intersectTriangle(origin, direction, triangles.corner(triangle, 0), triangles.corner(triangle, 1), triangles.corner(triangle, 2), t) && t < maxT)
+                {
+                    maxT = t;
+                    hit = Hit{t, triangle};
+                    found = true;
+                }
+            }
+            continue;
+        }
+        stack[stackSize++] = node.first;
+        stack[stackSize++] = node.first + 1;
+    }
+    return found;
+}
+
+namespace
+{
+    struct SimdVec3
+    {
+        SimdFloat x, y, z;
+
+        SimdVec3() = default;
+        SimdVec3(const SimdFloat &x, const SimdFloat &y, const SimdFloat &z) : x(x), y(y), z(z) {}
+        explicit SimdVec3(const Vec3 &v) : x(v.x), y(v.y), z(v.z) {}
+
+        SimdVec3 operator-(const SimdVec3 &o) const { return SimdVec3(x - o.x, y - o.y, z - o.z); }
+        SimdFloat dot(const SimdVec3 &o) const { return x * o.x + y * o.y + z * o.z; }
+        SimdVec3 cross(const SimdVec3 &o) const { return SimdVec3(y * o.z - z * o.y, z * o.x - x * o.z, x * o.y - y * o.x); }
+    };
+}
+
+int PGK_BVH::closestHitPacket(const Triangles &triangles, const Vec3 *origins, const Vec3 *directions, const float *maxT, int count, Hit *hits) const
+{
+    if (isEmpty() || count <= 0)
+        return 0;
+
+    // transpose into lanes, unused lanes repeat the first ray and stay masked out
+    alignas(32) float lanes[9][PACKET_SIZE];
+    alignas(32) float active[PACKET_SIZE];
+    for (int i = 0; i < PACKET_SIZE; ++i)
+    {
+        const int ray = i < count ? i : 0;
+        const Ray inverse = makeRay(origins[ray], directions[ray]);
+        lanes[0][i] = origins[ray].x;
+        lanes[1][i] = origins[ray].y;
+        lanes[2][i] = origins[ray].z;
+        lanes[3][i] = directions[ray].x;
+        lanes[4][i] = directions[ray].y;
+        lanes[5][i] = directions[ray].z;
+        lanes[6][i] = inverse.invDirection.x;
+        lanes[7][i] = inverse.invDirection.y;
+        lanes[8][i] = inverse.invDirection.z;
+        active[i] = i < count ? maxT[i] : 0;
+    }
+    const SimdVec3 origin(SimdFloat::load(lanes[0]), SimdFloat::load(lanes[1]), SimdFloat::load(lanes[2]));
+    const SimdVec3 direction(SimdFloat::load(lanes[3]), SimdFloat::load(lanes[4]), SimdFloat::load(lanes[5]));
+    const SimdVec3 invDirection(SimdFloat::load(lanes[6]), SimdFloat::load(lanes[7]), SimdFloat::load(lanes[8]));
+    // an inactive lane has maxT 0, which no triangle and no node can beat
+    SimdFloat closest = SimdFloat::load(active);
+
+    const SimdFloat zero(0.0f);
+    const SimdFloat one(1.0f);
+    const SimdFloat epsilon(0.000001f);
+    const SimdFloat padding(1e-4f);
+    uint32_t hitTriangles[PACKET_SIZE];
+    int hitMask = 0;
+
+    uint32_t stack[STACK_SIZE];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+
+    while (stackSize > 0)
+    {
+        const Node &node = nodes[stack[--stackSize]];
+
+        // same slab test as intersectBounds, one ray per lane
+        const SimdFloat tx1 = (SimdFloat(node.bounds.min.x) - padding - origin.x) * invDirection.x;
+        const SimdFloat tx2 = (SimdFloat(node.bounds.max.x) + padding - origin.x) * invDirection.x;
+        const SimdFloat ty1 = (SimdFloat(node.bounds.min.y) - padding - origin.y) * invDirection.y;
+        const SimdFloat ty2 = (SimdFloat(node.bounds.max.y) + padding - origin.y) * invDirection.y;
+        const SimdFloat tz1 = (SimdFloat(node.bounds.min.z) - padding - origin.z) * invDirection.z;
+        const SimdFloat tz2 = (SimdFloat(node.bounds.max.z) + padding - origin.z) * invDirection.z;
+        const SimdFloat tNear = SimdFloat::max(SimdFloat::max(SimdFloat::min(tx1, tx2), SimdFloat::min(ty1, ty2)), SimdFloat::min(tz1, tz2));
+        const SimdFloat tFar = SimdFloat::min(SimdFloat::min(SimdFloat::max(tx1, tx2), SimdFloat::max(ty1, ty2)), SimdFloat::max(tz1, tz2));
+        if (((tNear <= tFar) & (tFar > zero) & (tNear < closest) & (closest > zero)).mask() == 0)
+            continue;
+
+        if (node.count > 0)
+        {
+            for (uint32_t i = node.first; i < node.first + node.count; ++i)
+            {
+                // Moller-Trumbore like PGK_Math::intersectTriangle, one triangle against every lane
+                const uint32_t triangle = primitives[i];
+                const Vec3 &v0 = triangles.corner(triangle, 0);
+                const SimdVec3 edge1(triangles.corner(triangle, 1) - v0);
+                const SimdVec3 edge2(triangles.corner(triangle, 2) - v0);
+                const SimdVec3 h = direction.cross(edge2);
+                const SimdFloat a = edge1.dot(h);
+                const SimdFloat f = one / a;
+                const SimdVec3 s = origin - SimdVec3(v0);
+                const SimdFloat u = f * s.dot(h);
+                const SimdVec3 q = s.cross(edge1);
+                const SimdFloat w = f * direction.dot(q);
+                const SimdFloat t = f * edge2.dot(q);
+
+                const SimdFloat valid = ((a > epsilon) | (a < zero - epsilon)) & (u >= zero) & (u <= one) & (w >= zero) &
+                                        (u + w <= one) & (t > epsilon) & (t < closest);
+                const int mask = valid.mask();
+                if (mask == 0)
+                    continue;
+
+                closest = SimdFloat::select(valid, t, closest);
+                hitMask |= mask;
+                for (int lane = 0; lane < PACKET_SIZE; ++lane)
+                {
+                    if (mask & (1 << lane))
+                        hitTriangles[lane] = triangle;
+                }
+            }
+            continue;
+        }
+        stack[stackSize++] = node.first;
+        stack[stackSize++] = node.first + 1;
+    }
+
+    alignas(32) float distances[PACKET_SIZE];
+    closest.store(distances);
+    for (int lane = 0; lane < count; ++lane)
+    {
+        if (hitMask & (1 << lane))
+            hits[lane] = Hit{distances[lane], hitTriangles[lane]};
+    }
+    return hitMask;
+}
+
+void PGK_BVH::buildNode(const Triangles &triangles, uint32_t nodeIndex, uint32_t first, uint32_t count, int depth, PGK_JobSystem::Counter &counter)
+{
+    Node &node = nodes[nodeIndex];
+    node.bounds = Bounds();
+    Bounds centroidBounds;
+    for (uint32_t i = first; i < first + count; ++i)
+    {
+        node.bounds.grow(triangleBounds(triangles, primitives[i]));
+        centroidBounds.grow(centroids[primitives[i]]);
+    }
+    node.first = first;
+    node.count = count;
+    if (count <= 2)
+        return;
+
+    // split along the longest centroid axis
+    const Vec3 extent = centroidBounds.max - centroidBounds.min;
+    const int axis = extent.x > extent.y && extent.x > extent.z ? 0 : (extent.y > extent.z ? 1 : 2);
+    const auto axisValue = [axis](const Vec3 &v)
+    { return axis == 0 ? v.x : (axis == 1 ? v.y : v.z); };
+    const float axisMin = axisValue(centroidBounds.min);
+    const float axisExtent = axisValue(extent);
+
+    uint32_t leftCount = 0;
+    if (axisExtent > 0 && depth < MAX_SAH_DEPTH)
+    {
+        struct Bin
+        {
+            Bounds bounds;
+            uint32_t count = 0;
+        };
+        std::array<Bin, BIN_COUNT> bins;
+        const float binScale = BIN_COUNT / axisExtent;
+        const auto binOf = [&](uint32_t triangle)
+        { return std::min(BIN_COUNT - 1, static_cast<int>((axisValue(centroids[triangle]) - axisMin) * binScale)); };
+        for (uint32_t i = first; i < first + count; ++i)
+        {
+            Bin &bin = bins[binOf(primitives[i])];
+            bin.bounds.grow(triangleBounds(triangles, primitives[i]));
+            bin.count++;
+        }
+
+        // sweep from both sides, cost of splitting after bin i
+        std::array<float, BIN_COUNT - 1> leftArea, rightArea;
+        std::array<uint32_t, BIN_COUNT - 1> leftCounts;
+        Bounds leftBounds, rightBounds;
+        uint32_t leftSum = 0;
+        for (int i = 0; i < BIN_COUNT - 1; ++i)
+        {
+            leftBounds.grow(bins[i].bounds);
+            leftSum += bins[i].count;
+            leftArea[i] = leftBounds.area();
+            leftCounts[i] = leftSum;
+            rightBounds.grow(bins[BIN_COUNT - 1 - i].bounds);
+            rightArea[BIN_COUNT - 2 - i] = rightBounds.area();
+        }
+
+        int bestSplit = -1;
+        float bestCost = std::numeric_limits<float>::max();
+        for (int i = 0; i < BIN_COUNT - 1; ++i)
+        {
+            if (leftCounts[i] == 0 || leftCounts[i] == count)
+                continue;
+            const float cost = leftArea[i] * leftCounts[i] + rightArea[i] * (count - leftCounts[i]);
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                bestSplit = i;
+            }
+        }
+
+        // keep small nodes as leaves when splitting doesn't pay off
+        const float leafCost = node.bounds.area() * count;
+        if (bestSplit >= 0 && (bestCost < leafCost || count > MAX_LEAF_SIZE))
+        {
+            const auto middle = std::partition(primitives.begin() + first, primitives.begin() + first + count, [&](uint32_t triangle)
+                                               { return binOf(triangle) <= bestSplit; });
+            leftCount = middle - (primitives.begin() + first);
+        }
+        else if (count <= MAX_LEAF_SIZE)
+        {
+            return;
+        }
+    }
+    else if (count <= MAX_LEAF_SIZE)
+    {
+        return;
+    }
+
+    if (leftCount == 0)
+    {
+        // no usable SAH split, fall back to the median
+        leftCount = count / 2;
+        if (axisExtent > 0)
+        {
+            std::nth_element(primitives.begin() + first, primitives.begin() + first + leftCount, primitives.begin() + first + count, [&](uint32_t a, uint32_t b)
+                             { return axisValue(centroids[a]) < axisValue(centroids[b]); });
+        }
+    }
+
+    const uint32_t leftIndex = nodesUsed.fetch_add(2);
+    node.first = leftIndex;
+    node.count = 0;
+
+    if (count >= PARALLEL_BUILD_SIZE)
+    {
+        PGK_JobSystem::instance().submit([this, &triangles, leftIndex, first, leftCount, depth, &counter]()
+                                         { buildNode(triangles, leftIndex, first, leftCount, depth + 1, counter); }, &counter);
+    }
+    else
+    {
+        buildNode(triangles, leftIndex, first, leftCount, depth + 1, counter);
+    }
+    buildNode(triangles, leftIndex + 1, first + leftCount, count - leftCount, depth + 1, counter);
+}
+
+PGK_BVH::Bounds PGK_BVH::triangleBounds(const Triangles &triangles, uint32_t triangle)
+{
+    Bounds bounds;
+    bounds.grow(triangles.corner(triangle, 0));
+    bounds.grow(triangles.corner(triangle, 1));
+    bounds.grow(triangles.corner(triangle, 2));
+    return bounds;
+}
+
+float PGK_BVH::totalArea() const
+{
+    float area = 0;
+    for (const auto &node : nodes)
+    {
+        area += node.bounds.area();
+    }
+    return area;
+}
+
+PGK_BVH::Ray PGK_BVH::makeRay(const Vec3 &origin, const Vec3 &direction)
+{
+    // keep the inverse finite, fast math doesn't promise infinities
+    const auto inverse = [](float d)
+    { return 1.0f / (std::abs(d) > 1e-12f ? d : std::copysign(1e-12f, d)); };
+    return Ray{origin, Vec3(inverse(direction.x), inverse(direction.y), inverse(direction.z))};
+}
+
+bool PGK_BVH::intersectBounds(const Bounds &bounds, const Ray &ray, float maxT)
+{
+    // slabs, padded a little so flat nodes and grazing rays aren't lost to rounding
+    const float padding = 1e-4f;
+    const float tx1 = (bounds.min.x - padding - ray.origin.x) * ray.invDirection.x;
+    const float tx2 = (bounds.max.x + padding - ray.origin.x) * ray.invDirection.x;
+    const float ty1 = (bounds.min.y - padding - ray.origin.y) * ray.invDirection.y;
+    const float ty2 = (bounds.max.y + padding - ray.origin.y) * ray.invDirection.y;
+    const float tz1 = (bounds.min.z - padding - ray.origin.z) * ray.invDirection.z;
+    const float tz2 = (bounds.max.z + padding - ray.origin.z) * ray.invDirection.z;
+    const float tNear = std::max({std::min(tx1, tx2), std::min(ty1, ty2), std::min(tz1, tz2)});
+    const float tFar = std::min({std::max(tx1, tx2), std::max(ty1, ty2), std::max(tz1, tz2)});
+    return tNear <= tFar && tFar > 0 && tNear < maxT;
+}
+
+bool PGK_BVH::intersectSphere(const Bounds &bounds, const Sphere &region)
+{
+    if (region.radius < 0)
+        return true;
+    const float dx = std::max({bounds.min.x - region.center.x, 0.0f, region.center.x - bounds.max.x});
+    const float dy = std::max({bounds.min.y - region.center.y, 0.0f, region.center.y - bounds.max.y});
+    const float dz = std::max({bounds.min.z - region.center.z, 0.0f, region.center.z - bounds.max.z});
+    return dx * dx + dy * dy + dz * dz <= region.radius * region.radius;
+}
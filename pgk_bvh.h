@@ -0,0 +1,156 @@
+#ifndef PGK_BVH_H
+#define PGK_BVH_H
+
+#include "pgk_jobsystem.h"
+#include "pgk_math.h"
+
+#include <atomic>
+#include <limits>
+#include <vector>
+
+// bounding volume hierarchy over triangles, built with binned SAH
+class PGK_BVH
+{
+public:
+    struct Hit
+    {
+        float t;
+        uint32_t triangle;
+    };
+
+    // only nodes touching the sphere are visited, a negative radius visits everything
+    struct Sphere
+    {
+        Vec3 center;
+        float radius = -1;
+    };
+
+    // where the corners of the triangles are read from. the tree keeps no copy of them, every
+    // query is handed the triangles it was built over. without indices triangle t is positions
+    // 3t to 3t + 2
+    struct Triangles
+    {
+        const Vec3 *positions = nullptr;
+        size_t stride = sizeof(Vec3); // bytes from one position to the next
+        const unsigned int *indices = nullptr;
+        size_t count = 0;
+
+        // three positions per triangle
+        static Triangles soup(const std::vector<Vec3> &vertices) { return Triangles{vertices.data(), sizeof(Vec3), nullptr, vertices.size() / 3}; }
+
+        const Vec3 &corner(uint32_t triangle, int i) const
+        {
+            const size_t index = indices ? indices[triangle * 3 + i] : triangle * 3 + i;
+            return *reinterpret_cast<const Vec3 *>(reinterpret_cast<const char *>(positions) + index * stride);
+        }
+    };
+
+    void build(const Triangles &triangles);
+    // keeps the tree and recomputes its bounds, the triangle count must not change
+    void refit(const Triangles &triangles);
+    // refit when possible, rebuild when the triangle count changed or the tree degraded
+    void update(const Triangles &triangles);
+
+    // the tree as raw bytes, deserialize restores it over the triangles it was built from and
+    // returns false when the data does not fit them
+    void serialize(std::vector<char> &data) const;
+    bool deserialize(const Triangles &triangles, const char *data, size_t size);
+
+    bool isEmpty() const { return triangleCount == 0; }
+    size_t getTriangleCount() const { return triangleCount; }
+    size_t getMemoryUsage() const;
+
+    // true on the first triangle the ray hits with 0 < t < maxT for which filter(triangle) is true
+    template <typename Filter>
+    bool anyHit(const Triangles &triangles, const Vec3 &origin, const Vec3 &direction, float maxT, const Sphere &region, Filter &&filter) const;
+    bool anyHit(const Triangles &triangles, const Vec3 &origin, const Vec3 &direction, float maxT = std::numeric_limits<float>::max()) const;
+    bool closestHit(const Triangles &triangles, const Vec3 &origin, const Vec3 &direction, float maxT, Hit &hit) const;
+
+    // traces up to PACKET_SIZE rays together, a node is visited when any of them touches it.
+    // bit i of the result is set when ray i hit something closer than maxT[i], hits[i] is only written then
+    static constexpr int PACKET_SIZE = SimdFloat::WIDTH;
+    int closestHitPacket(const Triangles &triangles, const Vec3 *origins, const Vec3 *directions, const float *maxT, int count, Hit *hits) const;
+
+private:
+    static constexpr int BIN_COUNT = 12;
+    static constexpr uint32_t MAX_LEAF_SIZE = 8;
+    static constexpr uint32_t PARALLEL_BUILD_SIZE = 4096;
+    static constexpr int MAX_SAH_DEPTH = 40; // median splits below, keeps the traversal stack bounded
+    static constexpr int STACK_SIZE = 96;
+
+    struct Bounds
+    {
+        Vec3 min = Vec3(std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
+        Vec3 max = Vec3(std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest());
+
+        void grow(const Vec3 &point);
+        void grow(const Bounds &bounds);
+        float area() const;
+    };
+
+    // leaves have count > 0 and own primitives [first, first + count), inner nodes have
+    // their children at first and first + 1
+    struct Node
+    {
+        Bounds bounds;
+        uint32_t first;
+        uint32_t count;
+    };
+
+    struct Ray
+    {
+        Vec3 origin;
+        Vec3 invDirection;
+    };
+
+    void buildNode(const Triangles &triangles, uint32_t nodeIndex, uint32_t first, uint32_t count, int depth, PGK_JobSystem::Counter &counter);
+    static Bounds triangleBounds(const Triangles &triangles, uint32_t triangle);
+    float totalArea() const;
+    static Ray makeRay(const Vec3 &origin, const Vec3 &direction);
+    static bool intersectBounds(const Bounds &bounds, const Ray &ray, float maxT);
+    static bool intersectSphere(const Bounds &bounds, const Sphere &region);
+
+    std::vector<Node> nodes;
+    std::vector<uint32_t> primitives;
+    std::vector<Vec3> centroids; // only during a build
+    std::atomic<uint32_t> nodesUsed = 0;
+    size_t triangleCount = 0;
+    float builtArea = 0;
+};
+
+template <typename Filter>
+bool PGK_BVH::anyHit(const Triangles &triangles, const Vec3 &origin, const Vec3 &direction, float maxT, const Sphere &region, Filter &&filter) const
+{
+    if (isEmpty())
+        return false;
+
+    const Ray ray = makeRay(origin, direction);
+    uint32_t stack[STACK_SIZE];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+    float t;
+
+    while (stackSize > 0)
+    {
+        const Node &node = nodes[stack[--stackSize]];
+        if (!intersectSphere(node.bounds, region) || !intersectBounds(node.bounds, ray, maxT))
+            continue;
+
+        if (node.count > 0)
+        {
+            for (uint32_t i = node.first; i < node.first + node.count; ++i)
+            {
+                const uint32_t triangle = primitives[i];
+                if (PGK_Math::intersectTriangle(origin, direction, triangles.corner(triangle, 0), triangles.corner(triangle, 1), triangles.corner(triangle, 2), t)
+                    && t < maxT && filter(triangle))
+                    return true;
+            }
+            continue;
+        }
+        stack[stackSize++] = node.first;
+        stack[stackSize++] = node.first + 1;
+    }
+    return false;
+}
+
+#endif // PGK_BVH_H
@@ -44,6 +44,10 @@ Mat4 PGK_Camera::getProjectionMatrix(const float &nearClip, const float &farClip
     return Mat4::PerspectiveProjection(fov, aspectRatio, nearClip, farClip);
 }
 
+Frustum PGK_Camera::getFrustum(const float &nearClip, const float &farClip) const {
+    return Frustum::fromViewProjection(getProjectionMatrix(nearClip, farClip) * viewMatrix, nearClip, farClip);
+}
+
 void PGK_Camera::updateFreeFly(float deltaTime) {
     auto& input = PGK_Input::instance();
 
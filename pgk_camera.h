@@ -24,6 +24,8 @@ public:
 
     Mat4 getViewMatrix() const;
     Mat4 getProjectionMatrix(const float &nearClip, const float &farClip) const;
+    // world space, for rejecting whole objects before their vertices are transformed
+    Frustum getFrustum(const float &nearClip, const float &farClip) const;
 
 private:
     Mode mode = Mode::Free;
@@ -6,6 +6,7 @@
 typedef struct PGK_CORE
 {
     size_t AVAILABLE_THREADS = 1;
+    bool PIN_THREADS = false;
     uint32_t RESOLUTION_WIDTH = 320;
     uint32_t RESOLUTION_HEIGHT = 240;
     bool WINDOWED = true;
@@ -14,9 +15,17 @@ typedef struct PGK_CORE
     int SHADING_MODE = 1; // 0: Flat, 1: Blinn-Phong, 2: GGX
     bool RAYCAST_SHADOWS = false;
     bool RENDER_FOG = false;
+    bool DEFERRED_SHADING = false; // rasterize to a visibility buffer, then shade every pixel once
     float ASPECT_RATIO = 4.f / 3.f;
     float REFRESH_RATE = 60;
     float SHADOW_DRAW_DISTANCE = 50.0f;
+    bool SHADOW_MAPS = false; // replaces RAYCAST_SHADOWS when both are set
+    uint32_t SHADOW_MAP_SIZE = 512;
+    int SHADOW_PCF_RADIUS = 1;
+    uint32_t TILE_SIZE = 32;
+    bool STREAM_ASSETS = false; // render placeholders while the scene's assets load
+    bool OCCLUSION_CULLING = false; // skip objects hidden behind the occluders before their vertex stage
+    float LOD_PIXEL_ERROR = 1.0f; // simplified meshes are drawn while they are off by at most this many pixels, 0 draws full meshes
 } PGK_CORE;
 
 extern PGK_CORE g_pgkCore;
@@ -2,9 +2,16 @@
 
 #include "pgk_core.h"
 #include "pgk_math.h"
+#include "pgk_shadowmap.h"
 
 #include <QPainter>
 #include <QThread>
+#include <array>
+#include <limits>
+#include <utility>
+
+// slack for the coarse depth tests, interpolated depth can exceed the vertex range by rounding
+static constexpr float DEPTH_EPSILON = 1e-6f;
 
 inline void PGK_Draw::drawPixel(QImage &target, const cVec3 &color, int16_t x0, int16_t y0)
 {
@@ -60,248 +67,474 @@ inline void PGK_Draw::drawCircle(QImage &target, const cVec3 &color, int16_t x0,
     }
 }
 
-void PGK_Draw::drawTriangle(QImage &target, const Triangle &triangle, std::vector<float> &zBuffer, const std::vector<std::shared_ptr<PGK_Light>> &lights, const Vec3 &cameraPos, const std::vector<Triangle> &triangleBuffer)
+// values every fragment of a triangle shares, computed once per triangle
+struct FragmentSetup
+{
+    float invW0, invW1, invW2;
+    float uv0x, uv0y, uv1x, uv1y, uv2x, uv2y;
+    Vec3 viewDir;
+    cVec3 flatColor;
+};
+
+// darkens a light's contribution like a raycast hit does, scaled by the lit fraction of the filter
+static cVec3 applyShadowMap(const cVec3 &lightColor, const PGK_ShadowMap &shadowMap, const Vec3 &surfacePos, const Vec3 &normal)
 {
-    const float area = PGK_Math::edgeFunction(triangle.s0, triangle.s1, triangle.s2);
-    if (area <= 0)
-        return; // backface
-    const float invArea = 1.0f / area;
+    const int shade = 128 + static_cast<int>(128 * shadowMap.getLitFraction(surfacePos, normal));
+    return cVec3((lightColor.x * shade) >> 8, (lightColor.y * shade) >> 8, (lightColor.z * shade) >> 8);
+}
 
-    // bounding box
-    const int minX = std::clamp(static_cast<int>(std::min({triangle.s0.x, triangle.s1.x, triangle.s2.x})), 0, target.width() - 1);
-    const int maxX = std::clamp(static_cast<int>(std::max({triangle.s0.x, triangle.s1.x, triangle.s2.x})), 0, target.width() - 1);
-    const int minY = std::clamp(static_cast<int>(std::min({triangle.s0.y, triangle.s1.y, triangle.s2.y})), 0, target.height() - 1);
-    const int maxY = std::clamp(static_cast<int>(std::max({triangle.s0.y, triangle.s1.y, triangle.s2.y})), 0, target.height() - 1);
+// any other shadow caster near the triangle on the ray towards the light
+static bool isShadowed(const Triangle &triangle, const Vec3 &surface, const Vec3 &lightDir, const ShadingContext &context)
+{
+    // casters are only considered if their center is within SHADOW_DRAW_DISTANCE (squared) of the
+    // triangle, nodes outside of that radius around it can be skipped
+    const PGK_BVH::Sphere region{triangle.worldPosition, std::sqrt(g_pgkCore.SHADOW_DRAW_DISTANCE) + 1e-3f};
+    return context.shadowBVH.anyHit(context.shadowTriangles, surface, lightDir, std::numeric_limits<float>::max(), region, [&](uint32_t index)
+                                    {
+        // a triangle doesn't shadow itself, which is found by its centroid like Triangle's operator==
+        const Vec3 center = (context.shadowTriangles.corner(index, 0) + context.shadowTriangles.corner(index, 1) + context.shadowTriangles.corner(index, 2)) / 3.0f;
+        return !(center == triangle.worldPosition) && triangle.worldPosition.distanceSq(center) <= g_pgkCore.SHADOW_DRAW_DISTANCE; });
+}
 
-    const std::array<float, 3> z = {triangle.ndc0.z, triangle.ndc1.z, triangle.ndc2.z};
-    const std::array<Vec2, 3> uv = {triangle.uv0, triangle.uv1, triangle.uv2};
-    const std::array<Vec3, 3> norms = {triangle.n0, triangle.n1, triangle.n2};
-
-    const float invW0 = 1.0f / triangle.v0.w;
-    const float invW1 = 1.0f / triangle.v1.w;
-    const float invW2 = 1.0f / triangle.v2.w;
-    const float uv0x = uv[0].x * invW0;
-    const float uv0y = uv[0].y * invW0;
-    const float uv1x = uv[1].x * invW1;
-    const float uv1y = uv[1].y * invW1;
-    const float uv2x = uv[2].x * invW2;
-    const float uv2y = uv[2].y * invW2;
-
-    const Vec3 viewDir = (cameraPos - triangle.worldPosition).normalize();
-
-    Vec3 normal;
-    cVec3 phongColor(0, 0, 0);
+static FragmentSetup setupFragments(const Triangle &triangle, const ShadingContext &context)
+{
+    FragmentSetup setup;
+    setup.invW0 = 1.0f / triangle.v0.w;
+    setup.invW1 = 1.0f / triangle.v1.w;
+    setup.invW2 = 1.0f / triangle.v2.w;
+    setup.uv0x = triangle.uv0.x * setup.invW0;
+    setup.uv0y = triangle.uv0.y * setup.invW0;
+    setup.uv1x = triangle.uv1.x * setup.invW1;
+    setup.uv1y = triangle.uv1.y * setup.invW1;
+    setup.uv2x = triangle.uv2.x * setup.invW2;
+    setup.uv2y = triangle.uv2.y * setup.invW2;
+    setup.viewDir = (context.cameraPos - triangle.worldPosition).normalize();
+    setup.flatColor = cVec3(0, 0, 0);
+
+    if (g_pgkCore.SHADING_MODE != 0)
+        return setup;
+
+    const Vec3 normal = ((triangle.n0 + triangle.n1 + triangle.n2) / 3).normalize();
     bool inShadow = false;
-    float t;
-
-    if (g_pgkCore.SHADING_MODE == 0)
+    // once per triangle, so every light: the triangle center can sit outside the tile
+    for (const auto &light : context.lights)
     {
-        normal = ((norms[0] + norms[1] + norms[2]) / 3).normalize();
-        for (const auto &light : lights)
+        inShadow = false;
+
+        const Vec3 surface = triangle.worldPosition + normal * 0.01f;
+
+        // spot lights replace this with their own direction in getLightTypeVariables
+        Vec3 lightDir = light.position - surface;
+
+        cVec3 lightColor = PGK_Draw::calculateFlatLighting(light, lightDir, normal, surface, *triangle.material);
+        if (g_pgkCore.SHADOW_MAPS && light.shadowMap && light.castShadows && triangle.receiveShadows)
+            lightColor = applyShadowMap(lightColor, *light.shadowMap, triangle.worldPosition, normal);
+        setup.flatColor += lightColor;
+
+        if (!g_pgkCore.RAYCAST_SHADOWS || g_pgkCore.SHADOW_MAPS)
+            continue;
+        if (!light.castShadows)
+            continue;
+        if (!triangle.receiveShadows)
+            continue;
+
+        inShadow = isShadowed(triangle, surface, lightDir, context);
+
+        if (inShadow)
         {
-            inShadow = false;
+            setup.flatColor = setup.flatColor >> 1;
+        }
+    }
+    return setup;
+}
 
-            const Vec3 surface = triangle.worldPosition + normal * 0.01f;
+// pixel pipeline features, every combination is compiled into its own kernel so the per
+// pixel code doesn't test g_pgkCore or the material
+enum class ShadingKernel { Flat, BlinnPhong, GGX };
+enum class TextureKernel { None, Nearest, Bilinear };
+enum class ShadowKernel { None, ShadowMap, Raycast };
+static constexpr int KERNEL_COUNT = 3 * 3 * 3 * 2 * 2;
 
-            Vec3 lightDir;
-            switch (light->lightType)
-            {
-            case PGK_Light::Type::Directional:
-            {
-                lightDir = (light->getWorldPosition() - surface);
-                break;
-            }
-            case PGK_Light::Type::Point:
-            {
-                lightDir = (light->getWorldPosition() - surface);
-                break;
-            }
-            case PGK_Light::Type::Spot:
+template <int KERNEL>
+struct KernelFeatures
+{
+    static constexpr ShadingKernel SHADING = ShadingKernel(KERNEL % 3);
+    static constexpr TextureKernel TEXTURE = TextureKernel(KERNEL / 3 % 3);
+    static constexpr ShadowKernel SHADOWS = ShadowKernel(KERNEL / 9 % 3);
+    static constexpr bool NORMAL_MAP = KERNEL / 27 % 2;
+    static constexpr bool FOG = KERNEL / 54 % 2;
+};
+
+// the kernel for the current settings and the triangle's material, features the shading
+// mode ignores are left off so they share a kernel
+static int selectKernel(const Triangle &triangle)
+{
+    const ShadingKernel shading = g_pgkCore.SHADING_MODE == 0 ? ShadingKernel::Flat : (g_pgkCore.SHADING_MODE == 1 ? ShadingKernel::BlinnPhong : ShadingKernel::GGX);
+    const bool lit = shading != ShadingKernel::Flat;
+    const TextureKernel texture = !triangle.material->hasTexture ? TextureKernel::None : (g_pgkCore.TEX_FILTERING ? TextureKernel::Bilinear : TextureKernel::Nearest);
+    ShadowKernel shadows = ShadowKernel::None;
+    if (lit && triangle.receiveShadows)
+    {
+        if (g_pgkCore.SHADOW_MAPS)
+            shadows = ShadowKernel::ShadowMap;
+        else if (g_pgkCore.RAYCAST_SHADOWS)
+            shadows = ShadowKernel::Raycast;
+    }
+    const bool normalMap = lit && triangle.material->normalMap;
+    return int(shading) + 3 * int(texture) + 9 * int(shadows) + 27 * normalMap + 54 * g_pgkCore.RENDER_FOG;
+}
+
+// lighting, texturing and fog of a single pixel, returned as a QImage::Format_RGB32 value
+template <int KERNEL>
+static uint32_t shadeFragment(const Triangle &triangle, const FragmentSetup &setup, float alpha, float beta, float gamma, const Tile &tile, const ShadingContext &context)
+{
+    typedef KernelFeatures<KERNEL> Features;
+
+    // perspective correction
+    const float w = 1.0f / (alpha * setup.invW0 + beta * setup.invW1 + gamma * setup.invW2);
+    const float u = w * (alpha * setup.uv0x + beta * setup.uv1x + gamma * setup.uv2x);
+    const float v = w * (alpha * setup.uv0y + beta * setup.uv1y + gamma * setup.uv2y);
+
+    cVec3 phongColor = setup.flatColor;
+    if constexpr (Features::SHADING != ShadingKernel::Flat)
+    {
+        // interpolate normals and tangents
+        Vec3 normal = (triangle.n0 * alpha + triangle.n1 * beta + triangle.n2 * gamma).normalize();
+
+        // normal mapping
+        if constexpr (Features::NORMAL_MAP) {
+            Vec3 tangent = (triangle.tangent * alpha + triangle.tangent * beta + triangle.tangent * gamma).normalize();
+            Vec3 bitangent = (triangle.bitangent * alpha + triangle.bitangent * beta + triangle.bitangent * gamma).normalize();
+            cVec3 nmColor = PGK_Draw::getColor(*triangle.material->normalMap, u * triangle.material->normalMap->width(), v * triangle.material->normalMap->height());
+            Vec3 tangentNormal(
+                ((nmColor.x / 255.0f) * 2.0f - 1.0f) * triangle.material->normalMapStrength,
+                ((nmColor.y / 255.0f) * 2.0f - 1.0f) * triangle.material->normalMapStrength,
+                (nmColor.z / 255.0f) * 2.0f - 1.0f
+            );
+            // transform from tangent to world space
+            normal = (tangent * tangentNormal.x + bitangent * tangentNormal.y + normal * tangentNormal.z).normalize();
+        }
+        bool inShadow = false;
+        phongColor = cVec3(0, 0, 0);
+        for (const uint32_t lightIndex : tile.lights)
+        {
+            const LightConstants &light = context.lights[lightIndex];
+            // barycentric surface
+            const Vec3 surface = Vec3(triangle.v0 * alpha + triangle.v1 * beta + triangle.v2 * gamma);
+
+            // spot lights replace this with their own direction in getLightTypeVariables
+            Vec3 lightDir = light.position - surface;
+            cVec3 lightColor;
+            if constexpr (Features::SHADING == ShadingKernel::BlinnPhong)
+                lightColor = PGK_Draw::calculateBlinnPhongLighting(light, lightDir, setup.viewDir, normal, surface, *triangle.material);
+            else
+                lightColor = PGK_Draw::calculateGGXLighting(light, lightDir, setup.viewDir, normal, surface, *triangle.material);
+            if constexpr (Features::SHADOWS == ShadowKernel::ShadowMap)
             {
-                lightDir = (light->getWorldRotation() * Vec3(0, -1, 0));
-                break;
+                if (light.shadowMap && light.castShadows)
+                    lightColor = applyShadowMap(lightColor, *light.shadowMap, surface, normal);
             }
-            }
-
-            cVec3 lightColor = PGK_Draw::calculateFlatLighting(light, lightDir, normal, surface, *triangle.material);
             phongColor += lightColor;
 
-            if (!g_pgkCore.RAYCAST_SHADOWS)
-                continue;
-            if (!light->castShadows)
-                continue;
-            if (!triangle.receiveShadows)
-                continue;
-
-            for (const auto &shadowCaster : triangleBuffer)
+            if constexpr (Features::SHADOWS == ShadowKernel::Raycast)
             {
-                if (!shadowCaster.castShadows || shadowCaster == triangle)
+                // a light that adds nothing here casts no shadow here either, so a tile's culled
+                // light list shades exactly like every light
+                if (!light.castShadows || lightColor == cVec3(0, 0, 0))
                     continue;
-                if (triangle.worldPosition.distanceSq(shadowCaster.worldPosition) > g_pgkCore.SHADOW_DRAW_DISTANCE)
-                    continue;
-                if (inShadow)
-                    break;
 
-                if (PGK_Math::intersectTriangle(surface, lightDir, shadowCaster.v0, shadowCaster.v1, shadowCaster.v2, t))
+                // Check for intersections with other objects
+                if (!inShadow)
+                    inShadow = isShadowed(triangle, surface, lightDir, context);
+
+                if (inShadow)
                 {
-                    inShadow = true;
-                    break;
+                    phongColor = phongColor >> 1;
                 }
             }
-
-            if (inShadow)
-            {
-                phongColor = phongColor >> 1;
-            }
         }
     }
 
-    for (int y = minY; y <= maxY; ++y)
+    // texture sampling
+    cVec3 texColor = cVec3(200, 200, 200); // default to gray if no texture
+    if constexpr (Features::TEXTURE == TextureKernel::Bilinear)
+    {
+        texColor = PGK_Draw::getInterpolatedColor(*triangle.material->texture, u * triangle.material->texture->width(), v * triangle.material->texture->height());
+    }
+    else if constexpr (Features::TEXTURE == TextureKernel::Nearest)
+    {
+        const int texWidth = triangle.material->texture->width();
+        const int texHeight = triangle.material->texture->height();
+        const int tx = std::clamp(static_cast<int>(u * texWidth), 0, texWidth - 1);
+        const int ty = std::clamp(static_cast<int>(v * texHeight), 0, texHeight - 1);
+        texColor = PGK_Draw::getColor(*triangle.material->texture, tx, ty);
+    }
+
+    cVec3 finalColor(
+        std::min(255, (phongColor.x * texColor.x) >> 8),
+        std::min(255, (phongColor.y * texColor.y) >> 8),
+        std::min(255, (phongColor.z * texColor.z) >> 8));
+
+    if constexpr (Features::FOG)
+    {
+        const Vec3 surface = triangle.v0 * alpha + triangle.v1 * beta + triangle.v2 * gamma;
+        finalColor = PGK_Draw::calculateFog(finalColor, surface, context.cameraPos);
+    }
+
+    return 0xff000000u | ((finalColor.x & 0xff) << 16) | ((finalColor.y & 0xff) << 8) | (finalColor.z & 0xff);
+}
+
+// true if the triangle is a backface or behind everything already drawn in the tile
+static bool isTriangleHidden(const Triangle &triangle, const Tile &tile)
+{
+    if (PGK_Math::edgeFunction(triangle.s0, triangle.s1, triangle.s2) <= 0)
+        return true;
+    return std::max({triangle.ndc0.z, triangle.ndc1.z, triangle.ndc2.z}) + DEPTH_EPSILON <= tile.minDepth;
+}
+
+// z-tested coverage of the triangle inside the tile, calls fragment(x, y, alpha, beta, gamma)
+// for every pixel that passed the depth test and keeps the tile's depth bounds up to date
+template <typename FragmentFunction>
+static void rasterizeTriangle(const Triangle &triangle, Tile &tile, std::vector<float> &zBuffer, int width, FragmentFunction &&fragment)
+{
+    const float invArea = 1.0f / PGK_Math::edgeFunction(triangle.s0, triangle.s1, triangle.s2);
+
+    // bounding box, clipped to the tile owned by the caller
+    const int minX = std::clamp(static_cast<int>(std::min({triangle.s0.x, triangle.s1.x, triangle.s2.x})), tile.minX, tile.maxX);
+    const int maxX = std::clamp(static_cast<int>(std::max({triangle.s0.x, triangle.s1.x, triangle.s2.x})), tile.minX, tile.maxX);
+    const int minY = std::clamp(static_cast<int>(std::min({triangle.s0.y, triangle.s1.y, triangle.s2.y})), tile.minY, tile.maxY);
+    const int maxY = std::clamp(static_cast<int>(std::max({triangle.s0.y, triangle.s1.y, triangle.s2.y})), tile.minY, tile.maxY);
+
+    const std::array<float, 3> z = {triangle.ndc0.z, triangle.ndc1.z, triangle.ndc2.z};
+    const float triangleMinZ = std::min({z[0], z[1], z[2]}) - DEPTH_EPSILON;
+    const float triangleMaxZ = std::max({z[0], z[1], z[2]}) + DEPTH_EPSILON;
+
+    // edge equations w(p) = (p.x - a.x) * (b.y - a.y) - (p.y - a.y) * (b.x - a.x), stepped
+    // incrementally along the row, SimdFloat::WIDTH pixels at a time
+    const SimdFloat lanes = SimdFloat::laneIndices();
+    const SimdFloat zero(0.f);
+    const SimdFloat e0dy(triangle.s2.y - triangle.s1.y), e1dy(triangle.s0.y - triangle.s2.y), e2dy(triangle.s1.y - triangle.s0.y);
+    const SimdFloat e0Step = e0dy * SimdFloat(float(SimdFloat::WIDTH));
+    const SimdFloat e1Step = e1dy * SimdFloat(float(SimdFloat::WIDTH));
+    const SimdFloat e2Step = e2dy * SimdFloat(float(SimdFloat::WIDTH));
+    const SimdFloat vInvArea(invArea), vz0(z[0]), vz1(z[1]), vz2(z[2]);
+
+    alignas(32) float alphas[SimdFloat::WIDTH];
+    alignas(32) float betas[SimdFloat::WIDTH];
+    alignas(32) float gammas[SimdFloat::WIDTH];
+    alignas(32) float depths[SimdFloat::WIDTH];
+
+    // walk the depth blocks under the bounding box, skipping the ones that are occluded
+    // or that the triangle doesn't touch
+    const int firstBlockX = tile.minX / DepthBlock::SIZE;
+    const int firstBlockY = tile.minY / DepthBlock::SIZE;
+    bool tileDepthChanged = false;
+
+    for (int blockY = minY / DepthBlock::SIZE; blockY <= maxY / DepthBlock::SIZE; ++blockY)
     {
-        float *zPtr = &zBuffer[minX + y * target.width()];
-        for (int x = minX; x <= maxX; ++x, ++zPtr)
+        for (int blockX = minX / DepthBlock::SIZE; blockX <= maxX / DepthBlock::SIZE; ++blockX)
         {
-            if (x < 0 || x >= target.width())
-                continue;
-            if (y < 0 || y >= target.height())
+            DepthBlock &block = tile.depthBlocks[(blockX - firstBlockX) + (blockY - firstBlockY) * tile.blocksX];
+            if (triangleMaxZ <= block.minDepth)
                 continue;
 
-            const Vec3 p(x + 0.5f, y + 0.5f, 0.f);
+            const int blockMinX = blockX * DepthBlock::SIZE;
+            const int blockMinY = blockY * DepthBlock::SIZE;
+            const int blockMaxX = std::min(blockMinX + DepthBlock::SIZE - 1, tile.maxX);
+            const int blockMaxY = std::min(blockMinY + DepthBlock::SIZE - 1, tile.maxY);
+            const int spanMinX = std::max(minX, blockMinX);
+            const int spanMaxX = std::min(maxX, blockMaxX);
+            const int spanMinY = std::max(minY, blockMinY);
+            const int spanMaxY = std::min(maxY, blockMaxY);
+            if (PGK_Draw::isRectOutsideTriangle(triangle, spanMinX, spanMinY, spanMaxX, spanMaxY))
+                continue;
 
-            const float w0 = PGK_Math::edgeFunction(triangle.s1, triangle.s2, p);
-            const float w1 = PGK_Math::edgeFunction(triangle.s2, triangle.s0, p);
-            const float w2 = PGK_Math::edgeFunction(triangle.s0, triangle.s1, p);
+            // nearer than anything in the block, no need to compare against the z-buffer
+            const bool depthAlwaysPasses = triangleMinZ > block.maxDepth;
+            const SimdFloat rowEnd(spanMaxX + 1.f);
+            bool blockDepthChanged = false;
 
-            if (w0 >= 0 && w1 >= 0 && w2 >= 0)
+            for (int y = spanMinY; y <= spanMaxY; ++y)
             {
-                // barycentric
-                const float alpha = w0 * invArea;
-                const float beta = w1 * invArea;
-                const float gamma = w2 * invArea;
+                const float py = y + 0.5f;
+                SimdFloat px = SimdFloat(spanMinX + 0.5f) + lanes;
+                SimdFloat w0 = (px - SimdFloat(triangle.s1.x)) * e0dy - SimdFloat((py - triangle.s1.y) * (triangle.s2.x - triangle.s1.x));
+                SimdFloat w1 = (px - SimdFloat(triangle.s2.x)) * e1dy - SimdFloat((py - triangle.s2.y) * (triangle.s0.x - triangle.s2.x));
+                SimdFloat w2 = (px - SimdFloat(triangle.s0.x)) * e2dy - SimdFloat((py - triangle.s0.y) * (triangle.s1.x - triangle.s0.x));
+                SimdFloat laneX = px;
 
-                // depth
-                float zVal = alpha * z[0] + beta * z[1] + gamma * z[2];
+                float *zRow = &zBuffer[y * width];
 
-                if (zVal > *zPtr)
+                for (int x = spanMinX; x <= spanMaxX; x += SimdFloat::WIDTH, w0 += e0Step, w1 += e1Step, w2 += e2Step, laneX += SimdFloat(float(SimdFloat::WIDTH)))
                 {
-                    *zPtr = zVal;
-                    // perspective correction
-                    const float w = 1.0f / (alpha * invW0 + beta * invW1 + gamma * invW2);
-                    const float u = w * (alpha * uv0x + beta * uv1x + gamma * uv2x);
-                    const float v = w * (alpha * uv0y + beta * uv1y + gamma * uv2y);
-
-                    if (g_pgkCore.SHADING_MODE != 0)
+                    const SimdFloat covered = (w0 >= zero) & (w1 >= zero) & (w2 >= zero) & (laneX < rowEnd);
+                    if (!covered.mask())
+                        continue;
+
+                    // barycentric
+                    const SimdFloat vAlpha = w0 * vInvArea;
+                    const SimdFloat vBeta = w1 * vInvArea;
+                    const SimdFloat vGamma = w2 * vInvArea;
+
+                    // depth test and write
+                    const SimdFloat zVal = vAlpha * vz0 + vBeta * vz1 + vGamma * vz2;
+                    const bool fullGroup = x + SimdFloat::WIDTH - 1 <= spanMaxX;
+                    if (!fullGroup)
                     {
-                        // interpolate normals and tangents
-                        normal = (norms[0] * alpha + norms[1] * beta + norms[2] * gamma).normalize();
-                        Vec3 tangent = (triangle.tangent * alpha + triangle.tangent * beta + triangle.tangent * gamma).normalize();
-                        Vec3 bitangent = (triangle.bitangent * alpha + triangle.bitangent * beta + triangle.bitangent * gamma).normalize();
-
-                        // normal mapping
-                        if (triangle.material->normalMap) {
-                            cVec3 nmColor = getColor(*triangle.material->normalMap, u * triangle.material->normalMap->width(), v * triangle.material->normalMap->height());
-                            Vec3 tangentNormal(
-                                ((nmColor.x / 255.0f) * 2.0f - 1.0f) * triangle.material->normalMapStrength,
-                                ((nmColor.y / 255.0f) * 2.0f - 1.0f) * triangle.material->normalMapStrength,
-                                (nmColor.z / 255.0f) * 2.0f - 1.0f
-                            );
-                            // transform from tangent to world space
-                            normal = (tangent * tangentNormal.x + bitangent * tangentNormal.y + normal * tangentNormal.z).normalize();
-                        }
-                        inShadow = false;
-                        phongColor = cVec3(0, 0, 0);
-                        for (const auto &light : lights)
-                        {
-                            // barycentric surface
-                            const Vec3 surface = Vec3(triangle.v0 * alpha + triangle.v1 * beta + triangle.v2 * gamma);
-
-                            Vec3 lightDir;
-                            switch (light->lightType)
-                            {
-                            case PGK_Light::Type::Directional:
-                            {
-                                lightDir = (light->getWorldPosition() - surface);
-                                break;
-                            }
-                            case PGK_Light::Type::Point:
-                            {
-                                lightDir = (light->getWorldPosition() - surface);
-                                break;
-                            }
-                            case PGK_Light::Type::Spot:
-                            {
-                                lightDir = (light->getWorldRotation() * Vec3(0, 0, -1));
-                                break;
-                            }
-                            }
-                            cVec3 lightColor;
-                            if(g_pgkCore.SHADING_MODE == 1) lightColor = PGK_Draw::calculateBlinnPhongLighting(light, lightDir, viewDir, normal, surface, *triangle.material);
-                            else lightColor = PGK_Draw::calculateGGXLighting(light, lightDir, viewDir, normal, surface, *triangle.material);
-                            phongColor += lightColor;
-
-                            if (!g_pgkCore.RAYCAST_SHADOWS)
-                                continue;
-                            if (!light->castShadows)
-                                continue;
-                            if (!triangle.receiveShadows)
-                                continue;
-
-                            // Check for intersections with other objects
-                            for (const auto &shadowCaster : triangleBuffer)
-                            {
-                                if (!shadowCaster.castShadows || shadowCaster == triangle)
-                                    continue;
-                                if (triangle.worldPosition.distanceSq(shadowCaster.worldPosition) > g_pgkCore.SHADOW_DRAW_DISTANCE)
-                                    continue;
-                                if (inShadow)
-                                    break;
-
-                                if (PGK_Math::intersectTriangle(surface, lightDir, shadowCaster.v0, shadowCaster.v1, shadowCaster.v2, t))
-                                {
-                                    inShadow = true;
-                                    break;
-                                }
-                            }
-
-                            if (inShadow)
-                            {
-                                phongColor = phongColor >> 1;
-                            }
-                        }
+                        std::fill(std::begin(depths), std::end(depths), std::numeric_limits<float>::max());
+                        std::copy(zRow + x, zRow + spanMaxX + 1, depths);
                     }
+                    const SimdFloat zOld = SimdFloat::load(fullGroup ? zRow + x : depths);
+                    const SimdFloat passed = depthAlwaysPasses ? covered : covered & (zVal > zOld);
+                    int passMask = passed.mask();
+                    if (!passMask)
+                        continue;
 
-                    // texture sampling
-                    cVec3 texColor = cVec3(200, 200, 200); // default to gray if no texture
-                    if(triangle.material->hasTexture)
+                    if (fullGroup)
                     {
-                        const int texWidth = triangle.material->texture->width();
-                        const int texHeight = triangle.material->texture->height();
-                        if (g_pgkCore.TEX_FILTERING)
-                            texColor = getInterpolatedColor(*triangle.material->texture, u * triangle.material->texture->width(), v * triangle.material->texture->height());
-                        else
-                        {
-                            const int tx = std::clamp(static_cast<int>(u * texWidth), 0, texWidth - 1);
-                            const int ty = std::clamp(static_cast<int>(v * texHeight), 0, texHeight - 1);
-                            texColor = getColor(*triangle.material->texture, tx, ty);
-                        }
+                        SimdFloat::select(passed, zVal, zOld).store(zRow + x);
                     }
+                    else
+                    {
+                        SimdFloat::select(passed, zVal, zOld).store(depths);
+                        std::copy(depths, depths + (spanMaxX + 1 - x), zRow + x);
+                    }
+                    blockDepthChanged = true;
 
-                    cVec3 finalColor(
-                        std::min(255, (phongColor.x * texColor.x) >> 8),
-                        std::min(255, (phongColor.y * texColor.y) >> 8),
-                        std::min(255, (phongColor.z * texColor.z) >> 8));
+                    vAlpha.store(alphas);
+                    vBeta.store(betas);
+                    vGamma.store(gammas);
 
-                    if(g_pgkCore.RENDER_FOG)
+                    while (passMask)
                     {
-                        const Vec3 surface = triangle.v0 * alpha + triangle.v1 * beta + triangle.v2 * gamma;
-                        finalColor = PGK_Draw::calculateFog(finalColor, surface, cameraPos);
+                        const int lane = PGK_Math::lowestSetBit(passMask);
+                        passMask &= passMask - 1;
+                        fragment(x + lane, y, alphas[lane], betas[lane], gammas[lane]);
                     }
+                }
+            }
 
-                    drawPixel(target, finalColor, x, y);
+            if (blockDepthChanged)
+            {
+                float blockMin = std::numeric_limits<float>::max();
+                float blockMax = std::numeric_limits<float>::lowest();
+                for (int y = blockMinY; y <= blockMaxY; ++y)
+                {
+                    const float *zRow = &zBuffer[y * width];
+                    for (int x = blockMinX; x <= blockMaxX; ++x)
+                    {
+                        blockMin = std::min(blockMin, zRow[x]);
+                        blockMax = std::max(blockMax, zRow[x]);
+                    }
                 }
+                block.minDepth = blockMin;
+                block.maxDepth = blockMax;
+                tileDepthChanged = true;
             }
         }
     }
+
+    if (tileDepthChanged)
+    {
+        float tileMin = std::numeric_limits<float>::max();
+        for (const auto &depthBlock : tile.depthBlocks)
+        {
+            tileMin = std::min(tileMin, depthBlock.minDepth);
+        }
+        tile.minDepth = tileMin;
+    }
+}
+
+typedef void (*TriangleKernel)(uint32_t *bits, int width, const Triangle &triangle, const FragmentSetup &setup, Tile &tile, std::vector<float> &zBuffer, const ShadingContext &context);
+typedef uint32_t (*FragmentKernel)(const Triangle &triangle, const FragmentSetup &setup, float alpha, float beta, float gamma, const Tile &tile, const ShadingContext &context);
+
+template <int KERNEL>
+static void drawTriangleKernel(uint32_t *bits, int width, const Triangle &triangle, const FragmentSetup &setup, Tile &tile, std::vector<float> &zBuffer, const ShadingContext &context)
+{
+    rasterizeTriangle(triangle, tile, zBuffer, width, [&](int x, int y, float alpha, float beta, float gamma)
+                      { bits[y * width + x] = shadeFragment<KERNEL>(triangle, setup, alpha, beta, gamma, tile, context); });
+}
+
+template <size_t... KERNELS>
+static constexpr std::array<TriangleKernel, sizeof...(KERNELS)> makeTriangleKernels(std::index_sequence<KERNELS...>)
+{
+    return {&drawTriangleKernel<KERNELS>...};
+}
+
+template <size_t... KERNELS>
+static constexpr std::array<FragmentKernel, sizeof...(KERNELS)> makeFragmentKernels(std::index_sequence<KERNELS...>)
+{
+    return {&shadeFragment<KERNELS>...};
+}
+
+// dispatch tables indexed by selectKernel
+static constexpr std::array<TriangleKernel, KERNEL_COUNT> TRIANGLE_KERNELS = makeTriangleKernels(std::make_index_sequence<KERNEL_COUNT>());
+static constexpr std::array<FragmentKernel, KERNEL_COUNT> FRAGMENT_KERNELS = makeFragmentKernels(std::make_index_sequence<KERNEL_COUNT>());
+
+void PGK_Draw::drawTriangle(QImage &target, const Triangle &triangle, Tile &tile, std::vector<float> &zBuffer, const ShadingContext &context)
+{
+    if (isTriangleHidden(triangle, tile))
+        return;
+
+    const FragmentSetup setup = setupFragments(triangle, context);
+    TRIANGLE_KERNELS[selectKernel(triangle)](reinterpret_cast<uint32_t *>(target.bits()), target.width(), triangle, setup, tile, zBuffer, context);
+}
+
+void PGK_Draw::drawTriangleVisibility(const Triangle &triangle, uint32_t triangleIndex, Tile &tile, std::vector<float> &zBuffer, std::vector<VisibilitySample> &visibilityBuffer, int width)
+{
+    if (isTriangleHidden(triangle, tile))
+        return;
+
+    rasterizeTriangle(triangle, tile, zBuffer, width, [&](int x, int y, float alpha, float beta, float)
+                      { visibilityBuffer[y * width + x] = VisibilitySample{triangleIndex, alpha, beta}; });
+}
+
+void PGK_Draw::shadeVisibilityTile(QImage &target, const Tile &tile, const std::vector<VisibilitySample> &visibilityBuffer, const ShadingContext &context)
+{
+    const int width = target.width();
+    uint32_t *bits = reinterpret_cast<uint32_t *>(target.bits());
+
+    // neighbouring pixels mostly belong to the same triangle, so keep its setup and kernel around
+    uint32_t setupIndex = VisibilitySample::NO_TRIANGLE;
+    FragmentSetup setup;
+    FragmentKernel kernel = nullptr;
+
+    for (int y = tile.minY; y <= tile.maxY; ++y)
+    {
+        for (int x = tile.minX; x <= tile.maxX; ++x)
+        {
+            const VisibilitySample &sample = visibilityBuffer[y * width + x];
+            if (sample.triangle == VisibilitySample::NO_TRIANGLE)
+                continue; // background
+
+            const Triangle &triangle = context.triangleBuffer[sample.triangle];
+            if (sample.triangle != setupIndex)
+            {
+                setup = setupFragments(triangle, context);
+                kernel = FRAGMENT_KERNELS[selectKernel(triangle)];
+                setupIndex = sample.triangle;
+            }
+            bits[y * width + x] = kernel(triangle, setup, sample.alpha, sample.beta, 1.0f - sample.alpha - sample.beta, tile, context);
+        }
+    }
+}
+
+bool PGK_Draw::isRectOutsideTriangle(const Triangle &triangle, int minX, int minY, int maxX, int maxY)
+{
+    // a pixel rect is outside if, for one of the edges, even the pixel center that
+    // maximizes the edge function is negative
+    const std::array<const Vec3 *, 3> edgeA = {&triangle.s1, &triangle.s2, &triangle.s0};
+    const std::array<const Vec3 *, 3> edgeB = {&triangle.s2, &triangle.s0, &triangle.s1};
+    for (int e = 0; e < 3; ++e)
+    {
+        const Vec3 &a = *edgeA[e];
+        const Vec3 &b = *edgeB[e];
+        const Vec3 corner((b.y - a.y) > 0 ? maxX + 0.5f : minX + 0.5f,
+                          (b.x - a.x) < 0 ? maxY + 0.5f : minY + 0.5f, 0.f);
+        if (PGK_Math::edgeFunction(a, b, corner) < 0)
+            return true;
+    }
+    return false;
 }
 
 void PGK_Draw::drawText(QImage &target, const QString &text, uint8_t size, int16_t x0, int16_t y0, QColor color)
@@ -388,47 +621,45 @@ inline cVec3 PGK_Draw::getInterpolatedColor(const QImage &image, float x, float
     return PGK_Math::interpolatecVec3(p00, p10, p01, p11, a, b);
 }
 
-cVec3 PGK_Draw::calculateBlinnPhongLighting(const std::shared_ptr<PGK_Light> &light, Vec3 &lightDir, const Vec3 &viewDir, const Vec3 &normal, const Vec3 &surfacePos, const Material& material)
+cVec3 PGK_Draw::calculateBlinnPhongLighting(const LightConstants &light, Vec3 &lightDir, const Vec3 &viewDir, const Vec3 &normal, const Vec3 &surfacePos, const Material& material)
 {
     float attenuation, spotEffect;
     getLightTypeVariables(light, surfacePos, lightDir, attenuation, spotEffect);
 
-    const float ambientStrength = 0.2f;
-    const float diffuseStrength = std::max(0.0f, normal.dot(lightDir)) * light->diffusePower;
+    const float diffuseStrength = std::max(0.0f, normal.dot(lightDir));
     const Vec3 halfDir = (lightDir + viewDir).normalize();
-    const float specularStrength = PGK_Math::fastpow(std::max(0.0f, normal.dot(halfDir)), material.specularExponent) * light->specularPower;
+    const float specularStrength = PGK_Math::fastpow(std::max(0.0f, normal.dot(halfDir)), material.specularExponent);
 
     const cVec3 result(
-        static_cast<uint16_t>(ambientStrength * material.ambient.x * light->ambientColor->x + diffuseStrength * material.diffuse.x * light->diffuseColor.x + specularStrength * material.specular.x * light->specularColor.x) * attenuation * spotEffect,
-        static_cast<uint16_t>(ambientStrength * material.ambient.y * light->ambientColor->y + diffuseStrength * material.diffuse.y * light->diffuseColor.y + specularStrength * material.specular.y * light->specularColor.y) * attenuation * spotEffect,
-        static_cast<uint16_t>(ambientStrength * material.ambient.z * light->ambientColor->z + diffuseStrength * material.diffuse.z * light->diffuseColor.z + specularStrength * material.specular.z * light->specularColor.z) * attenuation * spotEffect);
+        static_cast<uint16_t>(material.ambient.x * light.ambient.x + diffuseStrength * material.diffuse.x * light.diffuse.x + specularStrength * material.specular.x * light.specular.x) * attenuation * spotEffect,
+        static_cast<uint16_t>(material.ambient.y * light.ambient.y + diffuseStrength * material.diffuse.y * light.diffuse.y + specularStrength * material.specular.y * light.specular.y) * attenuation * spotEffect,
+        static_cast<uint16_t>(material.ambient.z * light.ambient.z + diffuseStrength * material.diffuse.z * light.diffuse.z + specularStrength * material.specular.z * light.specular.z) * attenuation * spotEffect);
 
     return result;
 }
 
-cVec3 PGK_Draw::calculateFlatLighting(const std::shared_ptr<PGK_Light> &light, Vec3 &lightDir, const Vec3 &normal, const Vec3 &surfacePos, const Material& material)
+cVec3 PGK_Draw::calculateFlatLighting(const LightConstants &light, Vec3 &lightDir, const Vec3 &normal, const Vec3 &surfacePos, const Material& material)
 {
     float attenuation, spotEffect;
     getLightTypeVariables(light, surfacePos, lightDir, attenuation, spotEffect);
 
-    const float ambientStrength = 0.2f;
-    const float diffuseStrength = std::max(0.0f, normal.dot(lightDir)) * light->diffusePower;
+    const float diffuseStrength = std::max(0.0f, normal.dot(lightDir));
 
     const cVec3 result(
-        static_cast<uint16_t>(ambientStrength * material.ambient.x * light->ambientColor->x + diffuseStrength * material.diffuse.x * light->diffuseColor.x) * attenuation * spotEffect,
-        static_cast<uint16_t>(ambientStrength * material.ambient.y * light->ambientColor->y + diffuseStrength * material.diffuse.y * light->diffuseColor.y) * attenuation * spotEffect,
-        static_cast<uint16_t>(ambientStrength * material.ambient.z * light->ambientColor->z + diffuseStrength * material.diffuse.z * light->diffuseColor.z) * attenuation * spotEffect);
+        static_cast<uint16_t>(material.ambient.x * light.ambient.x + diffuseStrength * material.diffuse.x * light.diffuse.x) * attenuation * spotEffect,
+        static_cast<uint16_t>(material.ambient.y * light.ambient.y + diffuseStrength * material.diffuse.y * light.diffuse.y) * attenuation * spotEffect,
+        static_cast<uint16_t>(material.ambient.z * light.ambient.z + diffuseStrength * material.diffuse.z * light.diffuse.z) * attenuation * spotEffect);
 
     return result;
 }
 
-cVec3 PGK_Draw::calculateGGXLighting(const std::shared_ptr<PGK_Light> &light, Vec3 &lightDir, const Vec3 &viewDir, const Vec3 &normal, const Vec3 &surfacePos, const Material& material)
+cVec3 PGK_Draw::calculateGGXLighting(const LightConstants &light, Vec3 &lightDir, const Vec3 &viewDir, const Vec3 &normal, const Vec3 &surfacePos, const Material& material)
 {
     float attenuation, spotEffect;
     getLightTypeVariables(light, surfacePos, lightDir, attenuation, spotEffect);
 
     // Use material.specularExponent to derive roughness
-    float roughness = 1.0f / std::max(1.0f, material.specularExponent); // Inverse specularExponent as roughness
+    float roughness = std::max(GGX_MIN_ROUGHNESS, 1.0f / std::max(1.0f, material.specularExponent)); // Inverse specularExponent as roughness
     float F0 = 0.04f; // Typical value for non-metals, could be parameterized
 
     Vec3 N = normal;
@@ -451,15 +682,15 @@ cVec3 PGK_Draw::calculateGGXLighting(const std::shared_ptr<PGK_Light> &light, Ve
     float k2 = k * k;
     float G = dotNL / (dotLH * dotLH * (1.0f - k2) + k2);
 
-    float ggx = dotNL * D * F * G;
+    // G can exceed 1 at grazing angles, the cap keeps the term within what the light range assumes
+    float ggx = std::min(dotNL * D * F * G, GGX_MAX_SPECULAR);
 
-    const float ambientStrength = 0.2f;
-    const float diffuseStrength = dotNL * light->diffusePower;
+    const float diffuseStrength = dotNL;
 
     cVec3 result(
-        static_cast<uint16_t>(ambientStrength * material.ambient.x * light->ambientColor->x + diffuseStrength * material.diffuse.x * light->diffuseColor.x + ggx * material.specular.x * light->specularColor.x) * attenuation * spotEffect,
-        static_cast<uint16_t>(ambientStrength * material.ambient.y * light->ambientColor->y + diffuseStrength * material.diffuse.y * light->diffuseColor.y + ggx * material.specular.y * light->specularColor.y) * attenuation * spotEffect,
-        static_cast<uint16_t>(ambientStrength * material.ambient.z * light->ambientColor->z + diffuseStrength * material.diffuse.z * light->diffuseColor.z + ggx * material.specular.z * light->specularColor.z) * attenuation * spotEffect);
+        static_cast<uint16_t>(material.ambient.x * light.ambient.x + diffuseStrength * material.diffuse.x * light.diffuse.x + ggx * material.specular.x * light.specular.x) * attenuation * spotEffect,
+        static_cast<uint16_t>(material.ambient.y * light.ambient.y + diffuseStrength * material.diffuse.y * light.diffuse.y + ggx * material.specular.y * light.specular.y) * attenuation * spotEffect,
+        static_cast<uint16_t>(material.ambient.z * light.ambient.z + diffuseStrength * material.diffuse.z * light.diffuse.z + ggx * material.specular.z * light.specular.z) * attenuation * spotEffect);
 
     return result;
 }
@@ -480,12 +711,11 @@ cVec3 PGK_Draw::calculateFog(const cVec3 &color, const Vec3 &surfacePos, const V
         static_cast<uint16_t>(color.z * (1.0f - fogFactor) + fogColor.z * fogFactor));
 }
 
-void PGK_Draw::getLightTypeVariables(const std::shared_ptr<PGK_Light> &light, const Vec3 &surfacePos, Vec3 &lightDir, float &attenuation, float &spotEffect)
+void PGK_Draw::getLightTypeVariables(const LightConstants &light, const Vec3 &surfacePos, Vec3 &lightDir, float &attenuation, float &spotEffect)
 {
-    float distance = 0.f;
     attenuation = 1.0f;
     spotEffect = 1.0f;
-    switch (light->lightType)
+    switch (light.type)
     {
     case PGK_Light::Type::Directional:
     {
@@ -494,39 +724,24 @@ void PGK_Draw::getLightTypeVariables(const std::shared_ptr<PGK_Light> &light, co
     }
     case PGK_Light::Type::Point:
     {
-        distance = lightDir.length();
+        const float distanceSq = lightDir.lengthSq();
         lightDir.normalize();
-        attenuation = 1.0f / (1.0f + light->decay * distance * distance);
+        attenuation = 1.0f / (1.0f + light.decay * distanceSq);
         break;
     }
     case PGK_Light::Type::Spot:
     {
-        Vec3 spotDir = light->getWorldRotation() * Vec3(0, 0, -1);
-        Vec3 lightToSurface = (surfacePos - light->getWorldPosition()).normalize();
-        distance = (light->getWorldPosition() - surfacePos).length();
-        attenuation = 1.0f / (1.0f + light->decay * distance * distance);
+        const Vec3 lightToSurface = surfacePos - light.position;
+        const float distanceSq = lightToSurface.lengthSq();
+        lightDir = lightToSurface / std::sqrt(distanceSq);
+        attenuation = 1.0f / (1.0f + light.decay * distanceSq);
 
         // Spotlight cone calculation
-        float cosTheta = spotDir.dot(lightToSurface);
-        float cosPhi = std::cos(light->angle);
-        float cosGamma = std::cos(light->angle * (1.0f - light->penumbra));
-
-        if (cosTheta > cosPhi)
-        {
-            if (cosGamma != cosPhi)
-            {
-                spotEffect = std::pow((cosTheta - cosPhi) / (cosGamma - cosPhi), light->penumbra);
-            }
-            else
-            {
-                spotEffect = 1.0f;
-            }
-        }
-        else
-        {
+        const float cosTheta = light.direction.dot(lightDir);
+        if (cosTheta <= light.cosOuter)
             spotEffect = 0.0f;
-        }
-        lightDir = lightToSurface;
+        else if (light.cosInner != light.cosOuter)
+            spotEffect = std::pow((cosTheta - light.cosOuter) / (light.cosInner - light.cosOuter), light.penumbra);
         break;
     }
     }
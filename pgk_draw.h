@@ -3,8 +3,20 @@
 
 #include <QImage>
 
+#include "pgk_bvh.h"
 #include "pgk_light.h"
 #include "pgk_math.h"
+#include "pgk_view.h"
+
+// per frame inputs of the shading, shared by every tile
+struct ShadingContext
+{
+    const std::vector<Triangle> &triangleBuffer;
+    const std::vector<LightConstants> &lights;
+    const Vec3 cameraPos;
+    const PGK_BVH &shadowBVH;                 // the scene's shadow casters for raycast shadows
+    const PGK_BVH::Triangles shadowTriangles; // what shadowBVH is built over, world space
+};
 
 namespace PGK_Draw
 {
@@ -12,18 +24,21 @@ namespace PGK_Draw
     inline void drawPixel(QImage &target, const cVec3 &color, int16_t x0, int16_t y0);
     inline void drawLine(QImage &target, const cVec3 &color, int16_t x0, int16_t y0, int16_t x1, int16_t y1);
     inline void drawCircle(QImage &target, const cVec3 &color, int16_t x0, int16_t y0, float radius);
-    void drawTriangle(QImage &target, const Triangle &triangle, std::vector<float> &zBuffer, const std::vector<std::shared_ptr<PGK_Light>> &lights, const Vec3 &cameraPos, const std::vector<Triangle> &triangleBuffer);
+    void drawTriangle(QImage &target, const Triangle &triangle, Tile &tile, std::vector<float> &zBuffer, const ShadingContext &context);
+    void drawTriangleVisibility(const Triangle &triangle, uint32_t triangleIndex, Tile &tile, std::vector<float> &zBuffer, std::vector<VisibilitySample> &visibilityBuffer, int width);
+    void shadeVisibilityTile(QImage &target, const Tile &tile, const std::vector<VisibilitySample> &visibilityBuffer, const ShadingContext &context);
+    bool isRectOutsideTriangle(const Triangle &triangle, int minX, int minY, int maxX, int maxY);
     void drawText(QImage &target, const QString &text, uint8_t size, int16_t x0, int16_t y0, QColor color);
 
     inline void scanLine(QImage &target, cVec3 color, std::vector<QPoint> polygonPoints);
 
     inline cVec3 getColor(const QImage &image, int16_t x, int16_t y);
     inline cVec3 getInterpolatedColor(const QImage &image, float x, float y);
-    inline cVec3 calculateBlinnPhongLighting(const std::shared_ptr<PGK_Light> &light, Vec3 &lightDir, const Vec3 &viewDir, const Vec3 &normal, const Vec3 &surfacePos, const Material& material);
-    inline cVec3 calculateFlatLighting(const std::shared_ptr<PGK_Light> &light, Vec3 &lightDir, const Vec3 &normal, const Vec3 &surfacePos, const Material& material);
-    inline cVec3 calculateGGXLighting(const std::shared_ptr<PGK_Light> &light, Vec3 &lightDir, const Vec3 &viewDir, const Vec3 &normal, const Vec3 &surfacePos, const Material& material);
+    inline cVec3 calculateBlinnPhongLighting(const LightConstants &light, Vec3 &lightDir, const Vec3 &viewDir, const Vec3 &normal, const Vec3 &surfacePos, const Material& material);
+    inline cVec3 calculateFlatLighting(const LightConstants &light, Vec3 &lightDir, const Vec3 &normal, const Vec3 &surfacePos, const Material& material);
+    inline cVec3 calculateGGXLighting(const LightConstants &light, Vec3 &lightDir, const Vec3 &viewDir, const Vec3 &normal, const Vec3 &surfacePos, const Material& material);
     inline cVec3 calculateFog(const cVec3 &color, const Vec3 &surfacePos, const Vec3 &cameraPos, float fogStart = 50.0f, float fogEnd = 100.0f);
-    inline void getLightTypeVariables(const std::shared_ptr<PGK_Light> &light, const Vec3 &surfacePos, Vec3 &lightDir, float &attenuation, float &spotEffect);
+    inline void getLightTypeVariables(const LightConstants &light, const Vec3 &surfacePos, Vec3 &lightDir, float &attenuation, float &spotEffect);
 };
 
 #endif // PGK_DRAW_H
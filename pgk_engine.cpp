@@ -1,6 +1,7 @@
 #include "pgk_draw.h"
 #include "pgk_engine.h"
 #include "pgk_input.h"
+#include "pgk_jobsystem.h"
 #include <QDateTime>
 
 PGK_Engine::PGK_Engine(PGK_Scene *scene, PGK_View *view, QObject *parent)
@@ -11,6 +12,15 @@ PGK_Engine::PGK_Engine(PGK_Scene *scene, PGK_View *view, QObject *parent)
     PGK_Input::instance().update();
 }
 
+void PGK_Engine::startJobSystem() {
+    // worker pool lives for the whole session, the scene loader already uses it
+    PGK_JobSystem::instance().start(g_pgkCore.AVAILABLE_THREADS, g_pgkCore.PIN_THREADS);
+}
+
+void PGK_Engine::stopJobSystem() {
+    PGK_JobSystem::instance().stop();
+}
+
 void PGK_Engine::start() {
     timer.start();
 }
@@ -29,5 +39,17 @@ void PGK_Engine::update() {
 
     const float fps = 1.0f / deltaTime;
     PGK_Draw::drawText(this->view->canvas, "FPS: " + QString::number(fps), 10, 10, 20, Qt::white);
+    int16_t line = 40;
+    if (g_pgkCore.OCCLUSION_CULLING)
+    {
+        const PGK_Scene::OcclusionStats stats = scene->getOcclusionStats();
+        PGK_Draw::drawText(this->view->canvas, "Occluded: " + QString::number(stats.culled) + "/" + QString::number(stats.tested), 10, 10, line, Qt::white);
+        line += 20;
+    }
+    if (scene->isLoading())
+    {
+        const PGK_Scene::LoadProgress progress = scene->getLoadProgress();
+        PGK_Draw::drawText(this->view->canvas, "Loading: " + QString::number(progress.loaded) + "/" + QString::number(progress.total), 10, 10, line, Qt::white);
+    }
     
 }
@@ -12,6 +12,10 @@ public:
     PGK_Engine(PGK_Scene *scene, PGK_View *view, QObject *parent = nullptr);
     void start();
 
+    // the worker pool lives for the whole session, it is stopped once the scene is gone
+    static void startJobSystem();
+    static void stopJobSystem();
+
 private slots:
     void update();
 
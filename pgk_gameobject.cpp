@@ -1,7 +1,162 @@
 #include "pgk_gameobject.h"
+#include "pgk_core.h"
+#include "pgk_occlusion.h"
 
 #include <QThread>
 
+// triangles reaching past the screen are rasterized as they are as long as they stay within
+// GUARD_BAND times the screen extent, only larger ones are clipped against the side planes
+static constexpr float GUARD_BAND = 4.0f;
+
+// clip planes, the near and far ones bound w, the others are the guard band edges
+enum ClipPlane : uint8_t
+{
+    CLIP_NEAR = 1 << 0,
+    CLIP_FAR = 1 << 1,
+    CLIP_LEFT = 1 << 2,
+    CLIP_RIGHT = 1 << 3,
+    CLIP_BOTTOM = 1 << 4,
+    CLIP_TOP = 1 << 5
+};
+static constexpr uint8_t CLIP_DEPTH_PLANES = CLIP_NEAR | CLIP_FAR;
+static constexpr uint8_t CLIP_GUARD_PLANES = CLIP_LEFT | CLIP_RIGHT | CLIP_BOTTOM | CLIP_TOP;
+
+// a vertex of a triangle being clipped, its attributes are linear in clip space
+struct ClipVertex
+{
+    Vec4 clip;
+    Vec4 world;
+    Vec3 normal;
+    Vec2 texCoord;
+};
+
+// every clip plane adds at most one vertex to a convex polygon
+static constexpr int MAX_CLIP_VERTICES = 3 + 6;
+
+// clip space results of the vertex stage for the mesh being assembled
+struct TransformedVertex
+{
+    Vec4 clip;
+    Vec4 world;
+    Vec3 ndc;
+    Vec3 screen;
+    Vec3 normal;
+    uint8_t outcode; // clip planes the vertex is outside of, ndc and screen are unset outside near or far
+    uint32_t pass = 0; // the VertexStage::pass that wrote it, shared cluster vertices are transformed once
+};
+
+// scratch of the vertex stage, one per thread and reused by every object it draws, so it is only
+// as large as the largest mesh a thread has drawn instead of every object keeping its own
+struct VertexStage
+{
+    std::vector<TransformedVertex> vertices;
+    uint32_t pass = 0;
+    std::vector<uint32_t> visibleClusters;
+};
+static thread_local VertexStage t_vertexStage;
+
+// negative outside of the plane
+static float clipDistance(const Vec4 &clip, uint8_t plane, float nearClip, float farClip)
+{
+    switch (plane)
+    {
+    case CLIP_NEAR:
+        return clip.w - nearClip;
+    case CLIP_FAR:
+        return farClip - clip.w;
+    case CLIP_LEFT:
+        return clip.x + GUARD_BAND * clip.w;
+    case CLIP_RIGHT:
+        return GUARD_BAND * clip.w - clip.x;
+    case CLIP_BOTTOM:
+        return clip.y + GUARD_BAND * clip.w;
+    default:
+        return GUARD_BAND * clip.w - clip.y;
+    }
+}
+
+static uint8_t clipOutcode(const Vec4 &clip, float nearClip, float farClip)
+{
+    uint8_t outcode = 0;
+    for (uint8_t plane = CLIP_NEAR; plane <= CLIP_TOP; plane <<= 1)
+    {
+        if (clipDistance(clip, plane, nearClip, farClip) < 0)
+            outcode |= plane;
+    }
+    return outcode;
+}
+
+// Sutherland-Hodgman, the part of the polygon in front of one plane
+static int clipPolygon(const ClipVertex *polygon, int count, ClipVertex *clipped, uint8_t plane, float nearClip, float farClip)
+{
+    int clippedCount = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        const ClipVertex &a = polygon[i];
+        const ClipVertex &b = polygon[(i + 1) % count];
+        const float da = clipDistance(a.clip, plane, nearClip, farClip);
+        const float db = clipDistance(b.clip, plane, nearClip, farClip);
+        if (da >= 0)
+            clipped[clippedCount++] = a;
+        if ((da >= 0) != (db >= 0))
+        {
+            const float t = da / (da - db);
+            clipped[clippedCount++] = ClipVertex{a.clip + (b.clip - a.clip) * t, a.world + (b.world - a.world) * t,
+                                                 a.normal + (b.normal - a.normal) * t, a.texCoord + (b.texCoord - a.texCoord) * t};
+        }
+    }
+    return clippedCount;
+}
+
+// the world space box around an object space box transformed by m
+static void transformBox(const Mat4 &m, const Vec3 &min, const Vec3 &max, Vec3 &worldMin, Vec3 &worldMax)
+{
+    const Vec3 center = m * ((min + max) * 0.5f);
+    const Vec3 extent = (max - min) * 0.5f;
+    const Vec3 worldExtent(std::abs(m.m00) * extent.x + std::abs(m.m01) * extent.y + std::abs(m.m02) * extent.z,
+                           std::abs(m.m10) * extent.x + std::abs(m.m11) * extent.y + std::abs(m.m12) * extent.z,
+                           std::abs(m.m20) * extent.x + std::abs(m.m21) * extent.y + std::abs(m.m22) * extent.z);
+    worldMin = center - worldExtent;
+    worldMax = center + worldExtent;
+}
+
+// at least as much as m stretches any length, radii scale by this. the square root of the largest
+// absolute column sum times the largest absolute row sum bounds the largest singular value
+static float maxScale(const Mat4 &m)
+{
+    const float columnSum = std::max({std::abs(m.m00) + std::abs(m.m10) + std::abs(m.m20),
+                                      std::abs(m.m01) + std::abs(m.m11) + std::abs(m.m21),
+                                      std::abs(m.m02) + std::abs(m.m12) + std::abs(m.m22)});
+    const float rowSum = std::max({std::abs(m.m00) + std::abs(m.m01) + std::abs(m.m02),
+                                   std::abs(m.m10) + std::abs(m.m11) + std::abs(m.m12),
+                                   std::abs(m.m20) + std::abs(m.m21) + std::abs(m.m22)});
+    return std::sqrt(columnSum * rowSum);
+}
+
+// a level is kept until its error on screen grows past LOD_PIXEL_ERROR, but only switched to once
+// it is below LOD_HYSTERESIS times that, so objects at a threshold don't flicker between levels
+static constexpr float LOD_HYSTERESIS = 0.75f;
+
+// the level to draw, 0 for the full mesh and l for mesh.lods[l - 1], given the level drawn last.
+// pixelsPerUnit is the screen size of an object space unit at the mesh
+static size_t selectLod(const Mesh &mesh, size_t current, float pixelsPerUnit)
+{
+    // the errors grow with the level
+    const auto coarsestWithin = [&](float pixelError)
+    {
+        size_t level = 0;
+        while (level < mesh.lods.size() && mesh.lods[level].lodError * pixelsPerUnit <= pixelError)
+        {
+            level++;
+        }
+        return level;
+    };
+    const size_t allowed = coarsestWithin(g_pgkCore.LOD_PIXEL_ERROR);
+    if (current > allowed)
+        return allowed;
+    return std::max(current, coarsestWithin(g_pgkCore.LOD_PIXEL_ERROR * LOD_HYSTERESIS));
+}
+
 PGK_GameObject::PGK_GameObject()
     : localPosition(0, 0, 0), localEuler(0, 0, 0), localRotation(0, 0, 0, 1), localScale(1, 1, 1), parent(nullptr)
 {
@@ -20,6 +175,9 @@ PGK_GameObject::~PGK_GameObject()
 void PGK_GameObject::setParent(PGK_GameObject *parent)
 {
     this->parent = parent;
+    markTransformDirty();
+    if (parent)
+        parent->markBoundsDirty();
 }
 
 void PGK_GameObject::addChild(std::shared_ptr<PGK_GameObject> child)
@@ -31,29 +189,44 @@ void PGK_GameObject::addChild(std::shared_ptr<PGK_GameObject> child)
 void PGK_GameObject::setLocalPosition(const Vec3 &position)
 {
     localPosition = position;
+    markTransformDirty();
 }
 
 void PGK_GameObject::setLocalRotation(const Quat &rotation)
 {
     localRotation = rotation;
     localEuler = rotation.toEuler(Quat::RotationOrder::XYZ);
+    markTransformDirty();
 }
 
 void PGK_GameObject::setLocalEuler(const Vec3 &eulerAngles, const Quat::RotationOrder &order)
 {
     localEuler = eulerAngles;
     localRotation = Quat(eulerAngles, order);
+    markTransformDirty();
 }
 
 void PGK_GameObject::setLocalScale(const Vec3 &scale)
 {
     localScale = scale;
+    markTransformDirty();
 }
 
 void PGK_GameObject::setMeshes(const std::vector<Mesh> &meshes)
 {
-    this->gameObjectMesh = meshes;
+    setMeshes(std::make_shared<const std::vector<Mesh>>(meshes));
+}
+
+void PGK_GameObject::setMeshes(std::shared_ptr<const std::vector<Mesh>> meshes)
+{
+    this->gameObjectMesh = std::move(meshes);
     this->isVisible = true;
+    markBoundsDirty();
+}
+
+void PGK_GameObject::setTexture(std::shared_ptr<const QImage> texture)
+{
+    this->textureOverride = std::move(texture);
 }
 
 void PGK_GameObject::setName(const QString &name)
@@ -78,14 +251,13 @@ Quat PGK_GameObject::getLocalRotation() const
 
 Vec3 PGK_GameObject::getWorldPosition() const
 {
-    Mat4 worldTransform = getWorldTransform();
+    const Mat4 &worldTransform = getWorldTransform();
     return Vec3(worldTransform.m03, worldTransform.m13, worldTransform.m23);
 }
 
 Quat PGK_GameObject::getWorldRotation() const
 {
-    Mat4 worldTransform = getWorldTransform();
-    return Quat(worldTransform);
+    return Quat(getWorldTransform());
 }
 
 Vec3 PGK_GameObject::getWorldEuler() const
@@ -95,7 +267,7 @@ Vec3 PGK_GameObject::getWorldEuler() const
 
 Vec3 PGK_GameObject::getWorldScale() const
 {
-    Mat4 worldTransform = getWorldTransform();
+    const Mat4 &worldTransform = getWorldTransform();
     return Vec3(worldTransform.m00, worldTransform.m11, worldTransform.m22);
 }
 
@@ -114,9 +286,10 @@ PGK_GameObject *PGK_GameObject::getParent()
     return this->parent;
 }
 
-std::vector<Mesh> PGK_GameObject::getMeshes() const
+const std::vector<Mesh> &PGK_GameObject::getMeshes() const
 {
-    return this->gameObjectMesh;
+    static const std::vector<Mesh> noMeshes;
+    return this->gameObjectMesh ? *this->gameObjectMesh : noMeshes;
 }
 
 Mat4 PGK_GameObject::getLocalTransform() const
@@ -124,132 +297,468 @@ Mat4 PGK_GameObject::getLocalTransform() const
     return Mat4::Transform(localPosition, localRotation, localScale);
 }
 
-Mat4 PGK_GameObject::getWorldTransform() const
+const Mat4 &PGK_GameObject::getWorldTransform() const
 {
-    if (parent)
+    if (transformDirty)
     {
-        return parent->getWorldTransform() * getLocalTransform();
+        cachedWorldTransform = parent ? parent->getWorldTransform() * getLocalTransform() : getLocalTransform();
+        cachedNormalMatrix = PGK_Math::normalMatrix(cachedWorldTransform);
+        cachedInstanceWorldTransforms.resize(instanceTransforms.size());
+        cachedInstanceNormalMatrices.resize(instanceTransforms.size());
+        for (size_t i = 0; i < instanceTransforms.size(); ++i)
+        {
+            cachedInstanceWorldTransforms[i] = cachedWorldTransform * instanceTransforms[i];
+            cachedInstanceNormalMatrices[i] = PGK_Math::normalMatrix(cachedInstanceWorldTransforms[i]);
+        }
+        transformDirty = false;
     }
-    return getLocalTransform();
+    return cachedWorldTransform;
 }
 
-void PGK_GameObject::update(float &deltaTime)
+const Mat4 &PGK_GameObject::getNormalMatrix() const
 {
-    // Call custom update
-    if (onUpdate)
+    getWorldTransform();
+    return cachedNormalMatrix;
+}
+
+void PGK_GameObject::setInstances(const std::vector<Mat4> &transforms)
+{
+    instanceTransforms = transforms;
+    markTransformDirty();
+}
+
+const std::vector<Mat4> &PGK_GameObject::getInstances() const
+{
+    return instanceTransforms;
+}
+
+size_t PGK_GameObject::getInstanceCount() const
+{
+    return instanceTransforms.empty() ? 1 : instanceTransforms.size();
+}
+
+const Mat4 &PGK_GameObject::getInstanceWorldTransform(size_t instance) const
+{
+    const Mat4 &worldTransform = getWorldTransform();
+    return instanceTransforms.empty() ? worldTransform : cachedInstanceWorldTransforms[instance];
+}
+
+const Mat4 &PGK_GameObject::getInstanceNormalMatrix(size_t instance) const
+{
+    const Mat4 &normalMatrix = getNormalMatrix();
+    return instanceTransforms.empty() ? normalMatrix : cachedInstanceNormalMatrices[instance];
+}
+
+const PGK_GameObject::Bounds &PGK_GameObject::getBounds() const
+{
+    if (boundsDirty)
+        updateBounds();
+    return cachedBounds;
+}
+
+const PGK_GameObject::Bounds &PGK_GameObject::getSubtreeBounds() const
+{
+    if (boundsDirty)
+        updateBounds();
+    return cachedSubtreeBounds;
+}
+
+void PGK_GameObject::updateBounds() const
+{
+    Bounds bounds;
+    for (size_t instance = 0; instance < getInstanceCount(); instance++)
     {
-        onUpdate(this, deltaTime);
+        const Mat4 &worldTransform = getInstanceWorldTransform(instance);
+        for (const auto &mesh : getMeshes())
+        {
+            if (mesh.vertices.empty())
+                continue;
+            Vec3 meshMin, meshMax;
+            transformBox(worldTransform, mesh.boundsMin, mesh.boundsMax, meshMin, meshMax);
+            bounds.min = Vec3(std::min(bounds.min.x, meshMin.x), std::min(bounds.min.y, meshMin.y), std::min(bounds.min.z, meshMin.z));
+            bounds.max = Vec3(std::max(bounds.max.x, meshMax.x), std::max(bounds.max.y, meshMax.y), std::max(bounds.max.z, meshMax.z));
+            bounds.radius = 0;
+        }
+    }
+    if (bounds.radius >= 0)
+    {
+        // around the box center, taken from the mesh spheres when they are tighter than the box corners
+        bounds.center = (bounds.min + bounds.max) * 0.5f;
+        float sphereRadius = 0;
+        for (size_t instance = 0; instance < getInstanceCount(); instance++)
+        {
+            const Mat4 &worldTransform = getInstanceWorldTransform(instance);
+            for (const auto &mesh : getMeshes())
+            {
+                if (!mesh.vertices.empty())
+                    sphereRadius = std::max(sphereRadius, bounds.center.distance(worldTransform * mesh.boundsCenter) + mesh.boundsRadius * maxScale(worldTransform));
+            }
+        }
+        bounds.radius = std::min(sphereRadius, bounds.center.distance(bounds.max));
     }
+    cachedBounds = bounds;
 
-    // Update children
     for (const auto &child : children)
     {
-        child->update(deltaTime);
+        const Bounds &childBounds = child->getSubtreeBounds();
+        if (childBounds.radius < 0)
+            continue;
+        bounds.min = Vec3(std::min(bounds.min.x, childBounds.min.x), std::min(bounds.min.y, childBounds.min.y), std::min(bounds.min.z, childBounds.min.z));
+        bounds.max = Vec3(std::max(bounds.max.x, childBounds.max.x), std::max(bounds.max.y, childBounds.max.y), std::max(bounds.max.z, childBounds.max.z));
+        bounds.radius = 0;
+    }
+    if (bounds.radius >= 0 && !children.empty())
+    {
+        bounds.center = (bounds.min + bounds.max) * 0.5f;
+        bounds.radius = bounds.center.distance(bounds.max);
     }
+    cachedSubtreeBounds = bounds;
+    boundsDirty = false;
 }
 
-void PGK_GameObject::getTriangleBuffer(std::vector<Triangle> &triangleBuffer, PGK_View *view, const Mat4 &viewMatrix, const Mat4 &projectionMatrix)
+void PGK_GameObject::updateWorldTransforms()
 {
+    getWorldTransform();
     for (const auto &child : children)
     {
-        child->getTriangleBuffer(triangleBuffer, view, viewMatrix, projectionMatrix);
+        child->updateWorldTransforms();
     }
-    if (!isVisible)
+    getSubtreeBounds();
+}
+
+void PGK_GameObject::markTransformDirty()
+{
+    // children of a dirty object are already dirty, so the walk stops there
+    if (transformDirty)
         return;
-    Mat4 worldTransform;
-    Mat4 modelViewInvTrs;
-    if (isStatic && !staticInit)
+    transformDirty = true;
+    markBoundsDirty();
+    for (const auto &child : children)
     {
-        worldTransform = getWorldTransform();
-        modelViewInvTrs = PGK_Math::normalMatrix(worldTransform);
-        cachedWorldTransform = worldTransform;
-        cachedNormalMatrix = modelViewInvTrs;
-        staticInit = true;
+        child->markTransformDirty();
     }
-    else if (isStatic && staticInit)
+}
+
+void PGK_GameObject::markBoundsDirty()
+{
+    // the subtree bounds of the parents contain this object's, so they are dirty as well
+    for (PGK_GameObject *object = this; object && !object->boundsDirty; object = object->parent)
     {
-        worldTransform = cachedWorldTransform;
-        modelViewInvTrs = cachedNormalMatrix;
+        object->boundsDirty = true;
     }
-    else
+}
+
+void PGK_GameObject::update(float &deltaTime)
+{
+    // Call custom update
+    if (onUpdate)
     {
-        worldTransform = getWorldTransform();
-        modelViewInvTrs = PGK_Math::normalMatrix(worldTransform);
+        onUpdate(this, deltaTime);
     }
 
-    for (size_t i = 0; i < this->gameObjectMesh.size(); i++)
+    // Update children
+    for (const auto &child : children)
     {
-        const Mesh *mesh = &this->gameObjectMesh[i];
-        const std::shared_ptr<Material> materialPtr = std::make_shared<Material>(mesh->material);
+        child->update(deltaTime);
+    }
+}
 
-        for (size_t i = 0; i < mesh->indices.size(); i += 3)
+void PGK_GameObject::getTriangleBuffer(std::vector<Triangle> &triangleBuffer, PGK_View *view, const Mat4 &viewMatrix, const Mat4 &projectionMatrix, const Frustum &frustum,
+                                       const PGK_OcclusionBuffer *occlusion)
+{
+    if (!getSubtreeBounds().intersects(frustum))
+        return;
+    for (const auto &child : children)
+    {
+        child->getTriangleBuffer(triangleBuffer, view, viewMatrix, projectionMatrix, frustum, occlusion);
+    }
+    if (!isVisible || !getBounds().intersects(frustum))
+        return;
+    const Mat4 viewProjection = projectionMatrix * viewMatrix;
+    const Vec3 cameraPosition = viewMatrix.inverse() * Vec3(0, 0, 0);
+    const size_t instanceCount = getInstanceCount();
+    // screen pixels per world unit at distance 1
+    const float pixelsPerUnit = projectionMatrix.m11 * view->resHeight * 0.5f;
+
+    std::vector<TransformedVertex> &transformedVertices = t_vertexStage.vertices;
+    std::vector<uint32_t> &visibleClusters = t_vertexStage.visibleClusters;
+    const std::vector<Mesh> &meshes = getMeshes();
+    if (selectedLods.size() != meshes.size() * instanceCount)
+        selectedLods.assign(meshes.size() * instanceCount, 0);
+    for (size_t i = 0; i < meshes.size(); i++)
+    {
+        const Mesh &fullMesh = meshes[i];
+        const std::shared_ptr<Material> materialPtr = std::make_shared<Material>(fullMesh.material);
+        if (textureOverride)
         {
-            const Vec4 v0 = worldTransform * Vec4(mesh->vertices[mesh->indices[i]].position);
-            const Vec4 v1 = worldTransform * Vec4(mesh->vertices[mesh->indices[i + 1]].position);
-            const Vec4 v2 = worldTransform * Vec4(mesh->vertices[mesh->indices[i + 2]].position);
-
-            const Vec4 clipped0 = projectionMatrix * viewMatrix * v0;
-            const Vec4 clipped1 = projectionMatrix * viewMatrix * v1;
-            const Vec4 clipped2 = projectionMatrix * viewMatrix * v2;
+            materialPtr->texture = textureOverride;
+            materialPtr->hasTexture = true;
+        }
 
-            if (clipped0.w < view->nearClip)
-                continue;
-            if (clipped1.w < view->nearClip)
-                continue;
-            if (clipped2.w < view->nearClip)
-                continue;
-            if (clipped0.w > view->farClip)
-                continue;
-            if (clipped1.w > view->farClip)
-                continue;
-            if (clipped2.w > view->farClip)
+        // the instances of a mesh run back to back through the same buffers, only the matrices change
+        for (size_t instance = 0; instance < instanceCount; instance++)
+        {
+            const Mat4 &worldTransform = getInstanceWorldTransform(instance);
+            if (!frustum.intersects(fullMesh.boundsMin, fullMesh.boundsMax, worldTransform))
                 continue;
+            const Mat4 &modelViewInvTrs = getInstanceNormalMatrix(instance);
+
+            // level of detail by the screen size of its error, measured at the nearest point of the
+            // bounding sphere
+            uint8_t &lod = selectedLods[i * instanceCount + instance];
+            lod = static_cast<uint8_t>(std::min<size_t>(lod, fullMesh.lods.size()));
+            if (g_pgkCore.LOD_PIXEL_ERROR <= 0)
+                lod = 0;
+            else if (!fullMesh.lods.empty())
+            {
+                const float scale = maxScale(worldTransform);
+                const float distance = (worldTransform * fullMesh.boundsCenter).distance(cameraPosition) - fullMesh.boundsRadius * scale;
+                lod = static_cast<uint8_t>(selectLod(fullMesh, lod, pixelsPerUnit * scale / std::max(distance, view->nearClip)));
+            }
+            const Mesh *mesh = lod == 0 ? &fullMesh : &fullMesh.lods[lod - 1];
+            if (transformedVertices.size() < mesh->vertices.size())
+                transformedVertices.resize(mesh->vertices.size());
+            const Mat4 modelViewProjection = viewProjection * worldTransform;
+
+            // clusters outside the view, facing away from the camera or behind the occluders are
+            // dropped before any of their vertices are transformed, a mesh without clusters is drawn whole. the cones are
+            // tested in object space, which a mirroring transform turns inside out
+            visibleClusters.clear();
+            if (!mesh->clusters.empty())
+            {
+                const Vec3 objectCamera = worldTransform.inverse() * cameraPosition;
+                const Vec3 axisX(worldTransform.m00, worldTransform.m10, worldTransform.m20);
+                const Vec3 axisY(worldTransform.m01, worldTransform.m11, worldTransform.m21);
+                const Vec3 axisZ(worldTransform.m02, worldTransform.m12, worldTransform.m22);
+                const bool coneCulling = axisX.cross(axisY).dot(axisZ) > 0;
+                for (uint32_t c = 0; c < mesh->clusters.size(); c++)
+                {
+                    const MeshCluster &cluster = mesh->clusters[c];
+                    const Vec3 toCluster = cluster.center - objectCamera;
+                    if (coneCulling && toCluster.dot(cluster.coneAxis) >= cluster.coneCutoff * toCluster.length() + cluster.radius)
+                        continue;
+                    if (!frustum.intersects(cluster.boundsMin, cluster.boundsMax, worldTransform))
+                        continue;
+                    if (occlusion)
+                    {
+                        Vec3 worldMin, worldMax;
+                        transformBox(worldTransform, cluster.boundsMin, cluster.boundsMax, worldMin, worldMax);
+                        if (occlusion->isOccluded(worldMin, worldMax))
+                            continue;
+                    }
+                    visibleClusters.push_back(c);
+                }
+                if (visibleClusters.empty())
+                    continue;
+            }
+
+            // vertex stage, every vertex is transformed once no matter how many triangles share it
+            const auto transformVertex = [&](unsigned int v)
+            {
+                const Vertex &vertex = mesh->vertices[v];
+                TransformedVertex &transformed = transformedVertices[v];
+                transformed.clip = modelViewProjection * Vec4(vertex.position);
+                transformed.world = worldTransform * Vec4(vertex.position);
+                transformed.normal = (modelViewInvTrs * Vec4(vertex.normal)).normalize();
+                transformed.outcode = clipOutcode(transformed.clip, view->nearClip, view->farClip);
+                if (transformed.outcode & CLIP_DEPTH_PLANES)
+                    return;
+                transformed.ndc = PGK_Math::clipToNDC(transformed.clip);
+                transformed.screen = PGK_Math::projectionToScreen(transformed.ndc, view->resWidth, view->resHeight, view->nearClip, view->farClip);
+            };
+            if (mesh->clusters.empty())
+            {
+                for (unsigned int v = 0; v < mesh->vertices.size(); v++)
+                {
+                    transformVertex(v);
+                }
+            }
+            else
+            {
+                if (++t_vertexStage.pass == 0)
+                {
+                    for (auto &transformed : transformedVertices)
+                    {
+                        transformed.pass = 0;
+                    }
+                    t_vertexStage.pass = 1;
+                }
+                for (const uint32_t c : visibleClusters)
+                {
+                    const MeshCluster &cluster = mesh->clusters[c];
+                    for (uint32_t v = cluster.firstVertex; v < cluster.firstVertex + cluster.vertexCount; v++)
+                    {
+                        TransformedVertex &transformed = transformedVertices[mesh->clusterVertices[v]];
+                        if (transformed.pass == t_vertexStage.pass)
+                            continue;
+                        transformed.pass = t_vertexStage.pass;
+                        transformVertex(mesh->clusterVertices[v]);
+                    }
+                }
+            }
+
+            // centroid is the source triangle's for every piece clipped out of it, shadow tests use it
+            // to tell triangles apart and to measure their distance
+            const auto emitTriangle = [&](const TransformedVertex &t0, const TransformedVertex &t1, const TransformedVertex &t2,
+                                          const Vec2 &uv0, const Vec2 &uv1, const Vec2 &uv2, const Vec3 &centroid, size_t triangle)
+            {
+                // culling first so rejected triangles cost no setup
+                if ((t1.ndc - t0.ndc).cross(t2.ndc - t0.ndc).z < 0)
+                    return;
+                const Triangle t = {
+                    this->receiveShadows,
+                    this->castShadows,
+                    centroid,
+                    t0.world, t1.world, t2.world,
+                    t0.ndc, t1.ndc, t2.ndc,
+                    t0.screen, t1.screen, t2.screen,
+                    t0.normal, t1.normal, t2.normal,
+                    uv0, uv1, uv2,
+                    mesh->tangents[triangle], mesh->bitangents[triangle],
+                    materialPtr};
+                triangleBuffer.push_back(t);
+            };
+
+            // primitive assembly
+            const auto assembleTriangles = [&](size_t firstIndex, size_t endIndex)
+            {
+                for (size_t i = firstIndex; i < endIndex; i += 3)
+                {
+                    const TransformedVertex &t0 = transformedVertices[mesh->indices[i]];
+                    const TransformedVertex &t1 = transformedVertices[mesh->indices[i + 1]];
+                    const TransformedVertex &t2 = transformedVertices[mesh->indices[i + 2]];
+                    const Vertex &a = mesh->vertices[mesh->indices[i]];
+                    const Vertex &b = mesh->vertices[mesh->indices[i + 1]];
+                    const Vertex &c = mesh->vertices[mesh->indices[i + 2]];
+
+                    const Vec3 centroid = (t0.world + t1.world + t2.world) / 3.0f;
+                    const uint8_t outside = t0.outcode | t1.outcode | t2.outcode;
+                    const uint8_t allOutside = t0.outcode & t1.outcode & t2.outcode;
+                    if (allOutside & CLIP_DEPTH_PLANES)
+                        continue;
+                    // inside the guard band, or entirely off screen past one of its edges where the
+                    // binning drops it
+                    if (!(outside & CLIP_DEPTH_PLANES) && (!(outside & CLIP_GUARD_PLANES) || (allOutside & CLIP_GUARD_PLANES)))
+                    {
+                        emitTriangle(t0, t1, t2, a.texCoord, b.texCoord, c.texCoord, centroid, i / 3);
+                        continue;
+                    }
+
+                    // clipped against the planes it crosses, near and far first so w is positive
+                    // when the guard band is tested
+                    ClipVertex polygons[2][MAX_CLIP_VERTICES] = {{ClipVertex{t0.clip, t0.world, t0.normal, a.texCoord},
+                                                                 ClipVertex{t1.clip, t1.world, t1.normal, b.texCoord},
+                                                                 ClipVertex{t2.clip, t2.world, t2.normal, c.texCoord}}};
+                    int count = 3;
+                    int current = 0;
+                    for (const uint8_t plane : {CLIP_NEAR, CLIP_FAR})
+                    {
+                        if (!(outside & plane))
+                            continue;
+                        count = clipPolygon(polygons[current], count, polygons[1 - current], plane, view->nearClip, view->farClip);
+                        current = 1 - current;
+                    }
+                    uint8_t guardOutside = 0;
+                    uint8_t guardAllOutside = CLIP_GUARD_PLANES;
+                    for (int v = 0; v < count; ++v)
+                    {
+                        const uint8_t outcode = clipOutcode(polygons[current][v].clip, view->nearClip, view->farClip);
+                        guardOutside |= outcode;
+                        guardAllOutside &= outcode;
+                    }
+                    if (!(guardAllOutside & CLIP_GUARD_PLANES))
+                    {
+                        for (const uint8_t plane : {CLIP_LEFT, CLIP_RIGHT, CLIP_BOTTOM, CLIP_TOP})
+                        {
+                            if (!(guardOutside & plane) || count < 3)
+                                continue;
+                            count = clipPolygon(polygons[current], count, polygons[1 - current], plane, view->nearClip, view->farClip);
+                            current = 1 - current;
+                        }
+                    }
+                    if (count < 3)
+                        continue;
+
+                    TransformedVertex clipped[MAX_CLIP_VERTICES];
+                    for (int v = 0; v < count; ++v)
+                    {
+                        const ClipVertex &vertex = polygons[current][v];
+                        clipped[v].world = vertex.world;
+                        clipped[v].normal = Vec3(vertex.normal).normalize();
+                        clipped[v].ndc = PGK_Math::clipToNDC(vertex.clip);
+                        clipped[v].screen = PGK_Math::projectionToScreen(clipped[v].ndc, view->resWidth, view->resHeight, view->nearClip, view->farClip);
+                    }
+                    for (int v = 1; v + 1 < count; ++v)
+                    {
+                        emitTriangle(clipped[0], clipped[v], clipped[v + 1], polygons[current][0].texCoord,
+                                     polygons[current][v].texCoord, polygons[current][v + 1].texCoord, centroid, i / 3);
+                    }
+                }
+
+            };
+            if (mesh->clusters.empty())
+                assembleTriangles(0, mesh->indices.size());
+            for (const uint32_t c : visibleClusters)
+            {
+                assembleTriangles(mesh->clusters[c].firstIndex, mesh->clusters[c].firstIndex + mesh->clusters[c].indexCount);
+            }
+        }
+    }
+}
 
-            const Vec3 ndc0 = PGK_Math::clipToNDC(clipped0);
-            const Vec3 ndc1 = PGK_Math::clipToNDC(clipped1);
-            const Vec3 ndc2 = PGK_Math::clipToNDC(clipped2);
-
-            const Vec4 n0 = (modelViewInvTrs * Vec4(mesh->vertices[mesh->indices[i]].normal)).normalize();
-            const Vec4 n1 = (modelViewInvTrs * Vec4(mesh->vertices[mesh->indices[i + 1]].normal)).normalize();
-            const Vec4 n2 = (modelViewInvTrs * Vec4(mesh->vertices[mesh->indices[i + 2]].normal)).normalize();
-
-            const Vec3 screen0 = PGK_Math::projectionToScreen(ndc0, view->resWidth, view->resHeight, view->nearClip, view->farClip);
-            const Vec3 screen1 = PGK_Math::projectionToScreen(ndc1, view->resWidth, view->resHeight, view->nearClip, view->farClip);
-            const Vec3 screen2 = PGK_Math::projectionToScreen(ndc2, view->resWidth, view->resHeight, view->nearClip, view->farClip);
-
-            // Compute edges and UV deltas for normal mapping
-            Vec3 edge1 = mesh->vertices[mesh->indices[i + 1]].position - mesh->vertices[mesh->indices[i]].position;
-            Vec3 edge2 = mesh->vertices[mesh->indices[i + 2]].position - mesh->vertices[mesh->indices[i]].position;
-            Vec2 deltaUV1 = mesh->vertices[mesh->indices[i + 1]].texCoord - mesh->vertices[mesh->indices[i]].texCoord;
-            Vec2 deltaUV2 = mesh->vertices[mesh->indices[i + 2]].texCoord - mesh->vertices[mesh->indices[i]].texCoord;
-
-            float f = 1.0f / (deltaUV1.x * deltaUV2.y - deltaUV2.x * deltaUV1.y);
+// casters don't depend on the camera, so they are drawn at the coarsest level that is off by at most
+// LOD_PIXEL_ERROR texels while the mesh covers a whole shadow map
+static const Mesh &shadowLod(const Mesh &mesh)
+{
+    if (g_pgkCore.LOD_PIXEL_ERROR <= 0)
+        return mesh;
+    const float texelsPerUnit = g_pgkCore.SHADOW_MAP_SIZE / (2 * std::max(mesh.boundsRadius, 1e-6f));
+    size_t level = 0;
+    while (level < mesh.lods.size() && mesh.lods[level].lodError * texelsPerUnit <= g_pgkCore.LOD_PIXEL_ERROR)
+    {
+        level++;
+    }
+    return level == 0 ? mesh : mesh.lods[level - 1];
+}
 
-            Vec3 tangent = f * (edge1 * deltaUV2.y - edge2 * deltaUV1.y);
-            Vec3 bitangent = f * (edge2 * deltaUV1.x - edge1 * deltaUV2.x);
-            tangent.normalize();
-            bitangent.normalize();
+void PGK_GameObject::getShadowCasters(std::vector<ShadowCaster> &casters, bool coarse) const
+{
+    for (const auto &child : children)
+    {
+        child->getShadowCasters(casters, coarse);
+    }
+    if (!isVisible || !castShadows)
+        return;
+    for (size_t instance = 0; instance < getInstanceCount(); instance++)
+    {
+        for (const auto &mesh : this->getMeshes())
+        {
+            casters.push_back(ShadowCaster{coarse ? &shadowLod(mesh) : &mesh, getInstanceWorldTransform(instance)});
+        }
+    }
+}
 
-            if ((ndc1 - ndc0).cross(ndc2 - ndc0).z < 0)
+void PGK_GameObject::getOccluderVertices(std::vector<Vec3> &vertices)
+{
+    for (const auto &child : children)
+    {
+        child->getOccluderVertices(vertices);
+    }
+    if (!isVisible)
+        return;
+    for (size_t instance = 0; instance < getInstanceCount(); instance++)
+    {
+        const Mat4 &worldTransform = getInstanceWorldTransform(instance);
+        for (const auto &mesh : this->getMeshes())
+        {
+            if (mesh.material.hasAlphaMap)
                 continue;
-
-            const Triangle t = {
-                this->receiveShadows,
-                this->castShadows,
-                (v0 + v1 + v2) / 3.0f,
-                v0, v1, v2,
-                ndc0, ndc1, ndc2,
-                screen0, screen1, screen2,
-                n0, n1, n2,
-                mesh->vertices[mesh->indices[i]].texCoord,
-                mesh->vertices[mesh->indices[i + 1]].texCoord,
-                mesh->vertices[mesh->indices[i + 2]].texCoord,
-                tangent, bitangent,
-                materialPtr};
-            triangleBuffer.push_back(t);
+            for (const unsigned int index : mesh.indices)
+            {
+                vertices.push_back(worldTransform * mesh.vertices[index].position);
+            }
         }
     }
-    staticInit = true;
 }
 
 uint64_t PGK_GameObject::calcTriangleBufferSize()
@@ -261,7 +770,7 @@ uint64_t PGK_GameObject::calcTriangleBufferSize()
     }
     for (const auto &mesh : this->getMeshes())
     {
-        count += mesh.indices.size();
+        count += mesh.indices.size() * getInstanceCount();
     }
     return count;
 }
@@ -5,10 +5,12 @@
 #include "pgk_view.h"
 #include "pgk_rigidbody.h"
 #include "pgk_obj.h"
+#include <limits>
 #include <vector>
 #include <memory>
 
 class PGK_Light;
+class PGK_OcclusionBuffer;
 
 class PGK_GameObject {
 public:
@@ -25,6 +27,10 @@ public:
     void setLocalEuler(const Vec3& eulerAngles, const Quat::RotationOrder& order);
     void setLocalScale(const Vec3& scale);
     void setMeshes(const std::vector<Mesh> &meshes);
+    // shares the meshes instead of copying them, they must not change while they are set
+    void setMeshes(std::shared_ptr<const std::vector<Mesh>> meshes);
+    // drawn on every material of the meshes in place of their own texture, null draws their own
+    void setTexture(std::shared_ptr<const QImage> texture);
     void setName(const QString &name);
 
     Vec3 getLocalPosition() const;
@@ -37,13 +43,53 @@ public:
     QString getName() const;
     std::vector<std::shared_ptr<PGK_GameObject>> getChildren() const;
     PGK_GameObject* getParent();
-    std::vector<Mesh> getMeshes() const;
+    const std::vector<Mesh> &getMeshes() const;
     
     Mat4 getLocalTransform() const;
-    Mat4 getWorldTransform() const;
+    // cached, recomputed on the first read after this object or one of its parents moved
+    const Mat4 &getWorldTransform() const;
+    const Mat4 &getNormalMatrix() const;
+    // the meshes are drawn once per instance transform, each relative to this object instead of
+    // once at the object itself. children are attached to the object, not to its instances
+    void setInstances(const std::vector<Mat4> &transforms);
+    const std::vector<Mat4> &getInstances() const;
+    size_t getInstanceCount() const; // 1 when not instanced
+    // cached with the world transform, the object's own when not instanced
+    const Mat4 &getInstanceWorldTransform(size_t instance) const;
+    const Mat4 &getInstanceNormalMatrix(size_t instance) const;
+    // world space box and sphere, an empty one has a negative radius
+    struct Bounds
+    {
+        Vec3 min = Vec3(std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
+        Vec3 max = Vec3(std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest());
+        Vec3 center;
+        float radius = -1;
+
+        bool intersects(const Frustum &frustum) const { return radius >= 0 && frustum.intersects(center, radius) && frustum.intersects(min, max); }
+    };
+    // cached like the world transform. the object's own bounds cover its meshes at every instance,
+    // the subtree's also cover all of its children
+    const Bounds &getBounds() const;
+    const Bounds &getSubtreeBounds() const;
+    // resolves dirty transforms and bounds of the whole subtree, so worker threads only ever read the cache
+    void updateWorldTransforms();
 
     void update(float &deltaTime);
-    void getTriangleBuffer(std::vector<Triangle> &triangleBuffer, PGK_View *view, const Mat4& viewMatrix, const Mat4& projectionMatrix);
+    // subtrees, objects and instances outside of frustum are skipped before their vertex stage, and
+    // so are clusters behind the occluders of occlusion when it is set
+    void getTriangleBuffer(std::vector<Triangle> &triangleBuffer, PGK_View *view, const Mat4& viewMatrix, const Mat4& projectionMatrix, const Frustum &frustum,
+                           const PGK_OcclusionBuffer *occlusion = nullptr);
+    // a shadow casting mesh at one of the object's instances
+    struct ShadowCaster
+    {
+        const Mesh *mesh;
+        Mat4 worldTransform;
+    };
+    // every shadow casting mesh of the subtree once per instance, regardless of the camera. coarse
+    // takes the level of detail shadow maps draw instead of the full mesh
+    void getShadowCasters(std::vector<ShadowCaster> &casters, bool coarse) const;
+    // world space, three vertices per triangle of the subtree, without meshes that can be seen through
+    void getOccluderVertices(std::vector<Vec3> &vertices);
     uint64_t calcTriangleBufferSize();
 
     void addRigidbody(std::shared_ptr<PGK_Rigidbody> rigidbody);
@@ -52,7 +98,7 @@ public:
     bool receiveShadows=false;
     bool castShadows=false;
     bool isVisible=true;
-    bool isStatic=false;
+    bool isOccluder=false; // always drawn into the occlusion buffer, see PGK_Scene::renderOcclusion
 
 private:
     QString name;
@@ -62,11 +108,26 @@ private:
     Quat localRotation;
     Vec3 localScale;
 
-    bool staticInit = false;
-
-    std::vector<Mesh> gameObjectMesh;
-    Mat4 cachedWorldTransform;
-    Mat4 cachedNormalMatrix;
+    std::shared_ptr<const std::vector<Mesh>> gameObjectMesh;
+    std::shared_ptr<const QImage> textureOverride;
+    // a dirty object always has dirty children, see markTransformDirty
+    mutable Mat4 cachedWorldTransform;
+    mutable Mat4 cachedNormalMatrix;
+    mutable bool transformDirty = true;
+    std::vector<Mat4> instanceTransforms;
+    mutable std::vector<Mat4> cachedInstanceWorldTransforms;
+    mutable std::vector<Mat4> cachedInstanceNormalMatrices;
+    // a dirty object always has dirty parents, see markBoundsDirty
+    mutable Bounds cachedBounds;
+    mutable Bounds cachedSubtreeBounds;
+    mutable bool boundsDirty = true;
+
+    void markTransformDirty();
+    void markBoundsDirty();
+    void updateBounds() const;
+
+    // level of detail drawn last frame per mesh and instance, mesh * instance count + instance
+    std::vector<uint8_t> selectedLods;
 
     PGK_GameObject* parent;
     std::vector<std::shared_ptr<PGK_GameObject>> children;
@@ -0,0 +1,269 @@
+#include "pgk_jobsystem.h"
+
+#if defined(__linux__)
+#include <pthread.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#endif
+
+static thread_local size_t t_queueIndex = 0;
+// set while the thread runs a background job
+static thread_local bool t_background = false;
+
+PGK_JobSystem &PGK_JobSystem::instance()
+{
+    static PGK_JobSystem instance;
+    return instance;
+}
+
+PGK_JobSystem::~PGK_JobSystem()
+{
+    stop();
+}
+
+void PGK_JobSystem::start(size_t threadCount, bool pinThreads)
+{
+    stop();
+
+    const size_t workerCount = threadCount > 1 ? threadCount - 1 : 0;
+    queues.clear();
+    for (size_t i = 0; i <= workerCount; ++i)
+    {
+        queues.push_back(std::make_unique<WorkerQueue>());
+    }
+
+    running = true;
+    for (size_t i = 1; i <= workerCount; ++i)
+    {
+        workers.emplace_back(&PGK_JobSystem::workerLoop, this, i, pinThreads);
+    }
+}
+
+void PGK_JobSystem::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        running = false;
+    }
+    sleepCondition.notify_all();
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+    workers.clear();
+}
+
+size_t PGK_JobSystem::getThreadCount() const
+{
+    return workers.size() + 1;
+}
+
+void PGK_JobSystem::submit(Job job, Counter *counter, Priority priority)
+{
+    if (counter)
+        counter->pending++;
+
+    const bool background = priority == Priority::Background || t_background;
+    if (workers.empty())
+    {
+        Task task{std::move(job), counter, background};
+        runTask(task);
+        return;
+    }
+
+    {
+        WorkerQueue &queue = t_background ? backgroundParts : (background ? backgroundQueue : *queues[t_queueIndex]);
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(Task{std::move(job), counter, background});
+    }
+    queuedTasks++;
+
+    // taking the lock orders the push before a worker's predicate check, so the wakeup isn't lost
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+    }
+    sleepCondition.notify_one();
+}
+
+void PGK_JobSystem::wait(Counter &counter, Priority priority)
+{
+    // run queued work instead of blocking, this also makes nested waits from inside jobs safe
+    while (counter.pending > 0)
+    {
+        if (!runPendingTask(priority))
+            std::this_thread::yield();
+    }
+}
+
+bool PGK_JobSystem::runPendingTask(Priority priority)
+{
+    // a background job waiting on its own parts has to be able to run them, but starting another
+    // background job from inside one would stall it behind a whole load
+    const bool backgroundJobs = priority == Priority::Background && !t_background;
+    Task task;
+    if (!popTask(t_queueIndex, task, backgroundJobs || t_background, backgroundJobs))
+        return false;
+    runTask(task);
+    return true;
+}
+
+void PGK_JobSystem::parallelFor(size_t count, size_t grainSize, const std::function<void(size_t, size_t)> &body)
+{
+    if (count == 0)
+        return;
+    grainSize = std::max<size_t>(grainSize, 1);
+    if (workers.empty() || count <= grainSize)
+    {
+        body(0, count);
+        return;
+    }
+
+    // a few chunks per thread so stealing can even out uneven chunks
+    const size_t chunkCount = getThreadCount() * 4;
+    const size_t chunkSize = std::max(grainSize, (count + chunkCount - 1) / chunkCount);
+
+    Counter counter;
+    for (size_t begin = chunkSize; begin < count; begin += chunkSize)
+    {
+        const size_t end = std::min(begin + chunkSize, count);
+        submit([&body, begin, end]() { body(begin, end); }, &counter);
+    }
+    body(0, std::min(chunkSize, count));
+    wait(counter);
+}
+
+void PGK_JobSystem::workerLoop(size_t index, bool pinThread)
+{
+    t_queueIndex = index;
+
+    if (pinThread)
+    {
+        const size_t core = index % std::max(1u, std::thread::hardware_concurrency());
+#if defined(__linux__)
+        cpu_set_t cpuSet;
+        CPU_ZERO(&cpuSet);
+        CPU_SET(core, &cpuSet);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuSet);
+#elif defined(_WIN32)
+        SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << core);
+#endif
+    }
+
+    while (running)
+    {
+        Task task;
+        if (popTask(index, task, true, true))
+        {
+            runTask(task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        sleepCondition.wait(lock, [this]() { return !running || queuedTasks > 0; });
+    }
+}
+
+bool PGK_JobSystem::popTask(size_t index, Task &task, bool takeParts, bool takeJobs)
+{
+    if (queues.empty() || queuedTasks == 0)
+        return false;
+
+    // own queue from the back (most recent, still in cache)
+    {
+        WorkerQueue &queue = *queues[index];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.tasks.empty())
+        {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+            queuedTasks--;
+            return true;
+        }
+    }
+
+    // steal the oldest task of another queue
+    for (size_t i = 1; i < queues.size(); ++i)
+    {
+        WorkerQueue &queue = *queues[(index + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.tasks.empty())
+        {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+            queuedTasks--;
+            return true;
+        }
+    }
+
+    // parts first, they finish loads that are already under way
+    for (WorkerQueue *queue : {takeParts ? &backgroundParts : nullptr, takeJobs ? &backgroundQueue : nullptr})
+    {
+        if (!queue)
+            continue;
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        if (!queue->tasks.empty())
+        {
+            task = std::move(queue->tasks.front());
+            queue->tasks.pop_front();
+            queuedTasks--;
+            return true;
+        }
+    }
+    return false;
+}
+
+void PGK_JobSystem::runTask(Task &task)
+{
+    const bool wasBackground = t_background;
+    t_background = task.background;
+    task.job();
+    t_background = wasBackground;
+    if (task.counter)
+        task.counter->pending--;
+}
+
+PGK_TaskGraph::TaskId PGK_TaskGraph::addTask(PGK_JobSystem::Job job)
+{
+    auto node = std::make_unique<Node>();
+    node->job = std::move(job);
+    nodes.push_back(std::move(node));
+    return nodes.size() - 1;
+}
+
+void PGK_TaskGraph::addDependency(TaskId before, TaskId after)
+{
+    nodes[before]->successors.push_back(after);
+    nodes[after]->dependencyCount++;
+}
+
+void PGK_TaskGraph::run()
+{
+    PGK_JobSystem::Counter counter;
+    start(counter);
+    PGK_JobSystem::instance().wait(counter);
+}
+
+void PGK_TaskGraph::start(PGK_JobSystem::Counter &counter, PGK_JobSystem::Priority priority)
+{
+    for (auto &node : nodes)
+    {
+        node->remaining = node->dependencyCount;
+    }
+    for (TaskId id = 0; id < nodes.size(); ++id)
+    {
+        if (nodes[id]->dependencyCount == 0)
+            schedule(id, counter, priority);
+    }
+}
+
+void PGK_TaskGraph::schedule(TaskId id, PGK_JobSystem::Counter &counter, PGK_JobSystem::Priority priority)
+{
+    PGK_JobSystem::instance().submit([this, id, &counter, priority]()
+                                     {
+        Node &node = *nodes[id];
+        node.job();
+        for (const TaskId successor : node.successors) {
+            if (--nodes[successor]->remaining == 0)
+                schedule(successor, counter, priority);
+        } }, &counter, priority);
+}
@@ -0,0 +1,109 @@
+#ifndef PGK_JOBSYSTEM_H
+#define PGK_JOBSYSTEM_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class PGK_JobSystem
+{
+public:
+    typedef std::function<void()> Job;
+
+    struct Counter
+    {
+        std::atomic<size_t> pending = 0;
+    };
+
+    // background jobs (asset loading) only run on workers that have nothing else to do and in
+    // waits that ask for them, so a frame never ends up waiting on one. everything a background
+    // job submits is background too, but a part of one rather than a job of its own: a background
+    // job waiting on its parts only helps with parts, so it never starts another load
+    enum class Priority
+    {
+        Normal,
+        Background
+    };
+
+    static PGK_JobSystem &instance();
+
+    // threadCount includes the calling thread, which helps out while waiting
+    void start(size_t threadCount, bool pinThreads = false);
+    void stop();
+    size_t getThreadCount() const;
+
+    void submit(Job job, Counter *counter = nullptr, Priority priority = Priority::Normal);
+    // helps with queued jobs until counter drops to zero. background jobs only with
+    // Priority::Background, parts of them also when called from a background job
+    void wait(Counter &counter, Priority priority = Priority::Normal);
+    // runs one queued job on the calling thread, false when there was none
+    bool runPendingTask(Priority priority = Priority::Normal);
+    void parallelFor(size_t count, size_t grainSize, const std::function<void(size_t, size_t)> &body);
+
+private:
+    PGK_JobSystem() = default;
+    ~PGK_JobSystem();
+
+    struct Task
+    {
+        Job job;
+        Counter *counter = nullptr;
+        bool background = false;
+    };
+
+    struct WorkerQueue
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void workerLoop(size_t index, bool pinThread);
+    bool popTask(size_t index, Task &task, bool takeParts, bool takeJobs);
+    void runTask(Task &task);
+
+    // queues[0] is shared by threads outside the pool, queues[i] belongs to worker i
+    std::vector<std::unique_ptr<WorkerQueue>> queues;
+    // shared by everyone and run oldest first, loads finish in the order they were started.
+    // backgroundParts holds what background jobs submitted
+    WorkerQueue backgroundQueue;
+    WorkerQueue backgroundParts;
+    std::vector<std::thread> workers;
+    std::mutex sleepMutex;
+    std::condition_variable sleepCondition;
+    std::atomic<size_t> queuedTasks = 0;
+    std::atomic<bool> running = false;
+};
+
+class PGK_TaskGraph
+{
+public:
+    typedef size_t TaskId;
+
+    TaskId addTask(PGK_JobSystem::Job job);
+    void addDependency(TaskId before, TaskId after);
+    void run();
+    // schedules the graph and returns, it is done once counter drops to zero. the graph has
+    // to outlive that
+    void start(PGK_JobSystem::Counter &counter, PGK_JobSystem::Priority priority = PGK_JobSystem::Priority::Normal);
+    size_t getTaskCount() const { return nodes.size(); }
+
+private:
+    struct Node
+    {
+        PGK_JobSystem::Job job;
+        std::vector<TaskId> successors;
+        size_t dependencyCount = 0;
+        std::atomic<size_t> remaining = 0;
+    };
+
+    void schedule(TaskId id, PGK_JobSystem::Counter &counter, PGK_JobSystem::Priority priority);
+
+    std::vector<std::unique_ptr<Node>> nodes;
+};
+
+#endif // PGK_JOBSYSTEM_H
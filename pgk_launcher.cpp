@@ -28,7 +28,11 @@ PGK_Launcher::PGK_Launcher(QWidget *parent)
     // settingsRightLayout.addWidget(&scalingCheck);
     settingsRightLayout.addWidget(&texFilterCheck);
     settingsRightLayout.addWidget(&raycastShadowCheck);
+    settingsRightLayout.addWidget(&shadowMapCheck);
     settingsRightLayout.addWidget(&renderFogCheck);
+    settingsRightLayout.addWidget(&deferredShadingCheck);
+    settingsRightLayout.addWidget(&streamAssetsCheck);
+    settingsRightLayout.addWidget(&occlusionCullingCheck);
 
     QLabel shadingModeLabel("Shading Mode:");
     settingsRightLayout.addWidget(&shadingModeLabel);
@@ -111,7 +115,11 @@ QString PGK_Launcher::getCoreSettings() const
     g_pgkCore.TEX_FILTERING = this->texFilterCheck.isChecked();
     g_pgkCore.SHADING_MODE = this->shadingModeCBox.currentIndex();
     g_pgkCore.RAYCAST_SHADOWS = this->raycastShadowCheck.isChecked();
+    g_pgkCore.SHADOW_MAPS = this->shadowMapCheck.isChecked();
     g_pgkCore.RENDER_FOG = this->renderFogCheck.isChecked();
+    g_pgkCore.DEFERRED_SHADING = this->deferredShadingCheck.isChecked();
+    g_pgkCore.STREAM_ASSETS = this->streamAssetsCheck.isChecked();
+    g_pgkCore.OCCLUSION_CULLING = this->occlusionCullingCheck.isChecked();
     g_pgkCore.ASPECT_RATIO = (float)g_pgkCore.RESOLUTION_WIDTH / (float)g_pgkCore.RESOLUTION_HEIGHT;
     return sceneListWidget.currentItem()->text();
 }
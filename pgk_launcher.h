@@ -40,7 +40,11 @@ private:
     QCheckBox texFilterCheck = QCheckBox("Texture Filtering");
     QComboBox shadingModeCBox = QComboBox();
     QCheckBox raycastShadowCheck = QCheckBox("Raycast Shadows");
+    QCheckBox shadowMapCheck = QCheckBox("Shadow Maps");
     QCheckBox renderFogCheck = QCheckBox("Render Fog");
+    QCheckBox deferredShadingCheck = QCheckBox("Deferred Shading");
+    QCheckBox streamAssetsCheck = QCheckBox("Stream Assets");
+    QCheckBox occlusionCullingCheck = QCheckBox("Occlusion Culling");
 
     QListWidget sceneListWidget = QListWidget();
 
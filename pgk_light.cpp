@@ -1,3 +1,37 @@
 #include "pgk_light.h"
+#include "pgk_core.h"
+
+#include <algorithm>
+#include <cmath>
 
 PGK_Light::PGK_Light() : PGK_GameObject() {}
+
+LightConstants PGK_Light::getConstants() const
+{
+    const float ambientStrength = 0.2f;
+    LightConstants constants;
+    constants.type = lightType;
+    constants.position = getWorldPosition();
+    constants.direction = getWorldRotation() * Vec3(0, 0, -1);
+    constants.ambient = ambientColor ? Vec3(ambientColor->x, ambientColor->y, ambientColor->z) * ambientStrength : Vec3(0, 0, 0);
+    constants.diffuse = Vec3(diffuseColor.x, diffuseColor.y, diffuseColor.z) * diffusePower;
+    constants.specular = Vec3(specularColor.x, specularColor.y, specularColor.z) * specularPower;
+    constants.decay = decay;
+    constants.range = -1;
+    if (lightType != Type::Directional && decay > 0)
+    {
+        // the shading truncates each channel, so nothing is added once the brightest channel
+        // times the attenuation drops below 1, assuming material colors of at most 1. the ggx
+        // specular term goes up to GGX_MAX_SPECULAR instead of 1
+        const float specularPeak = g_pgkCore.SHADING_MODE == 2 ? GGX_MAX_SPECULAR : 1.0f;
+        const Vec3 brightest = constants.ambient + constants.diffuse + constants.specular * specularPeak;
+        const float intensity = std::max({brightest.x, brightest.y, brightest.z});
+        constants.range = std::sqrt(std::max(0.0f, (intensity - 1.0f) / decay));
+    }
+    constants.cosOuter = std::cos(angle);
+    constants.cosInner = std::cos(angle * (1.0f - penumbra));
+    constants.penumbra = penumbra;
+    constants.castShadows = castShadows;
+    constants.shadowMap = shadowMap.get();
+    return constants;
+}
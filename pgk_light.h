@@ -2,6 +2,15 @@
 #define PGK_LIGHT_H
 
 #include "pgk_gameobject.h"
+#include "pgk_shadowmap.h"
+
+struct LightConstants;
+
+// the smoothest surface the ggx shading models, smoother materials are shaded like it. the
+// specular term is capped at the peak of the distribution term there, 1 / (pi * roughness^4),
+// which keeps the range of a light finite
+static constexpr float GGX_MIN_ROUGHNESS = 0.2f;
+static constexpr float GGX_MAX_SPECULAR = 1.0f / (3.14159265f * GGX_MIN_ROUGHNESS * GGX_MIN_ROUGHNESS * GGX_MIN_ROUGHNESS * GGX_MIN_ROUGHNESS);
 
 class PGK_Light : public PGK_GameObject
 {
@@ -19,6 +28,7 @@ public:
     cVec3 specularColor = cVec3(255, 255, 255);
     bool castShadows = false;
     Type lightType = Type::Directional;
+    std::shared_ptr<PGK_ShadowMap> shadowMap;
 
     // Point
     float distance=10;
@@ -27,6 +37,27 @@ public:
     //Spot
     float angle=0.4f;
     float penumbra=0;
+
+    LightConstants getConstants() const;
+};
+
+// what the shading reads of a light, gathered once per frame so the per pixel loop doesn't
+// chase pointers, walk transforms or evaluate trigonometry
+struct alignas(64) LightConstants
+{
+    PGK_Light::Type type;
+    Vec3 position;
+    Vec3 direction;  // spot cone axis
+    Vec3 ambient;    // ambientColor, premultiplied by the ambient strength
+    Vec3 diffuse;    // diffuseColor * diffusePower
+    Vec3 specular;   // specularColor * specularPower
+    float decay;
+    float range;     // past it the light rounds to black, negative if it reaches everything
+    float cosOuter;  // cos(angle)
+    float cosInner;  // cos(angle * (1 - penumbra))
+    float penumbra;
+    bool castShadows;
+    const PGK_ShadowMap *shadowMap;
 };
 
 #endif // PGK_LIGHT_H
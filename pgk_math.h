@@ -5,6 +5,9 @@
 #include <algorithm>
 #include <cmath>
 #include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
 #include <cstdint>
 #include <QColor>
 
@@ -671,8 +674,91 @@ typedef T_Quat<double> dQuat;
 template <class T>
 const T_Quat<T> T_Quat<T>::IDENTITY(0, 0, 0, 1);
 
+// packed floats for the rasterizer and ray packets, 8 lanes with AVX2 or 4 lanes with SSE (blends
+// use SSE4.1 when it is enabled)
+#if defined(__AVX2__)
+class SimdFloat
+{
+public:
+    static constexpr int WIDTH = 8;
+    __m256 v;
+
+    SimdFloat() : v(_mm256_setzero_ps()) {}
+    SimdFloat(__m256 v) : v(v) {}
+    explicit SimdFloat(float s) : v(_mm256_set1_ps(s)) {}
+
+    static inline SimdFloat load(const float *p) { return _mm256_loadu_ps(p); }
+    static inline SimdFloat laneIndices() { return _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7); }
+    static inline SimdFloat select(const SimdFloat &mask, const SimdFloat &a, const SimdFloat &b) { return _mm256_blendv_ps(b.v, a.v, mask.v); }
+    static inline SimdFloat min(const SimdFloat &a, const SimdFloat &b) { return _mm256_min_ps(a.v, b.v); }
+    static inline SimdFloat max(const SimdFloat &a, const SimdFloat &b) { return _mm256_max_ps(a.v, b.v); }
+    inline void store(float *p) const { _mm256_storeu_ps(p, v); }
+    inline int mask() const { return _mm256_movemask_ps(v); }
+
+    inline SimdFloat operator+(const SimdFloat &o) const { return _mm256_add_ps(v, o.v); }
+    inline SimdFloat operator-(const SimdFloat &o) const { return _mm256_sub_ps(v, o.v); }
+    inline SimdFloat operator*(const SimdFloat &o) const { return _mm256_mul_ps(v, o.v); }
+    inline SimdFloat operator/(const SimdFloat &o) const { return _mm256_div_ps(v, o.v); }
+    inline SimdFloat& operator+=(const SimdFloat &o) { v = _mm256_add_ps(v, o.v); return *this; }
+    inline SimdFloat operator&(const SimdFloat &o) const { return _mm256_and_ps(v, o.v); }
+    inline SimdFloat operator|(const SimdFloat &o) const { return _mm256_or_ps(v, o.v); }
+    inline SimdFloat operator>(const SimdFloat &o) const { return _mm256_cmp_ps(v, o.v, _CMP_GT_OQ); }
+    inline SimdFloat operator>=(const SimdFloat &o) const { return _mm256_cmp_ps(v, o.v, _CMP_GE_OQ); }
+    inline SimdFloat operator<(const SimdFloat &o) const { return _mm256_cmp_ps(v, o.v, _CMP_LT_OQ); }
+    inline SimdFloat operator<=(const SimdFloat &o) const { return _mm256_cmp_ps(v, o.v, _CMP_LE_OQ); }
+};
+#else
+class SimdFloat
+{
+public:
+    static constexpr int WIDTH = 4;
+    __m128 v;
+
+    SimdFloat() : v(_mm_setzero_ps()) {}
+    SimdFloat(__m128 v) : v(v) {}
+    explicit SimdFloat(float s) : v(_mm_set1_ps(s)) {}
+
+    static inline SimdFloat load(const float *p) { return _mm_loadu_ps(p); }
+    static inline SimdFloat laneIndices() { return _mm_setr_ps(0, 1, 2, 3); }
+#if defined(__SSE4_1__)
+    static inline SimdFloat select(const SimdFloat &mask, const SimdFloat &a, const SimdFloat &b) { return _mm_blendv_ps(b.v, a.v, mask.v); }
+#else
+    // masks are whole lanes from a comparison, so and/andnot picks the same as the blend
+    static inline SimdFloat select(const SimdFloat &mask, const SimdFloat &a, const SimdFloat &b) { return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v)); }
+#endif
+    static inline SimdFloat min(const SimdFloat &a, const SimdFloat &b) { return _mm_min_ps(a.v, b.v); }
+    static inline SimdFloat max(const SimdFloat &a, const SimdFloat &b) { return _mm_max_ps(a.v, b.v); }
+    inline void store(float *p) const { _mm_storeu_ps(p, v); }
+    inline int mask() const { return _mm_movemask_ps(v); }
+
+    inline SimdFloat operator+(const SimdFloat &o) const { return _mm_add_ps(v, o.v); }
+    inline SimdFloat operator-(const SimdFloat &o) const { return _mm_sub_ps(v, o.v); }
+    inline SimdFloat operator*(const SimdFloat &o) const { return _mm_mul_ps(v, o.v); }
+    inline SimdFloat operator/(const SimdFloat &o) const { return _mm_div_ps(v, o.v); }
+    inline SimdFloat& operator+=(const SimdFloat &o) { v = _mm_add_ps(v, o.v); return *this; }
+    inline SimdFloat operator&(const SimdFloat &o) const { return _mm_and_ps(v, o.v); }
+    inline SimdFloat operator|(const SimdFloat &o) const { return _mm_or_ps(v, o.v); }
+    inline SimdFloat operator>(const SimdFloat &o) const { return _mm_cmpgt_ps(v, o.v); }
+    inline SimdFloat operator>=(const SimdFloat &o) const { return _mm_cmpge_ps(v, o.v); }
+    inline SimdFloat operator<(const SimdFloat &o) const { return _mm_cmplt_ps(v, o.v); }
+    inline SimdFloat operator<=(const SimdFloat &o) const { return _mm_cmple_ps(v, o.v); }
+};
+#endif
+
 namespace PGK_Math
 {
+    // index of the lowest set bit, mask must not be 0
+    inline int lowestSetBit(uint32_t mask)
+    {
+#if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanForward(&index, mask);
+        return static_cast<int>(index);
+#else
+        return __builtin_ctz(mask);
+#endif
+    }
+
     template <class T>
     inline const T_Mat4<T> worldMatrix(const T_Vec3<T> &pos, const T_Quat<T> &rot, const T_Vec3<T> &scale){
         return T_Mat4<T>(scale.x * (1 - 2 * rot.y * rot.y - 2 * rot.z * rot.z), scale.x * (2 * rot.x * rot.y - 2 * rot.z * rot.w), scale.x * (2 * rot.x * rot.z + 2 * rot.y * rot.w), pos.x,
@@ -749,4 +835,65 @@ namespace PGK_Math
     inline QColor QColorFromcVec3(const cVec3 &color){ return QColor(color.x,color.y,color.z); }
 };
 
+// six planes facing inwards, a point p is inside when dot(plane.xyz, p) + plane.w >= 0 for all of them.
+// the normals are unit length, so plane.w moves a plane by world units
+struct Frustum
+{
+    Vec4 planes[6];
+
+    // the volume -w <= x <= w, -w <= y <= w, near <= w <= far after viewProjection, the same
+    // bounds the vertex stage clips against
+    static Frustum fromViewProjection(const Mat4 &m, const float &near, const float &far){
+        Frustum frustum;
+        frustum.planes[0] = Vec4(m.m30 + m.m00, m.m31 + m.m01, m.m32 + m.m02, m.m33 + m.m03);
+        frustum.planes[1] = Vec4(m.m30 - m.m00, m.m31 - m.m01, m.m32 - m.m02, m.m33 - m.m03);
+        frustum.planes[2] = Vec4(m.m30 + m.m10, m.m31 + m.m11, m.m32 + m.m12, m.m33 + m.m13);
+        frustum.planes[3] = Vec4(m.m30 - m.m10, m.m31 - m.m11, m.m32 - m.m12, m.m33 - m.m13);
+        frustum.planes[4] = Vec4(m.m30, m.m31, m.m32, m.m33 - near);
+        frustum.planes[5] = Vec4(-m.m30, -m.m31, -m.m32, far - m.m33);
+        for (Vec4 &plane : frustum.planes)
+        {
+            plane /= Vec3(plane.x, plane.y, plane.z).length();
+        }
+        return frustum;
+    }
+
+    inline bool intersects(const Vec3 &center, const float &radius) const {
+        for (const Vec4 &plane : planes)
+        {
+            if (plane.x * center.x + plane.y * center.y + plane.z * center.z + plane.w < -radius)
+                return false;
+        }
+        return true;
+    }
+
+    // conservative, a box near a corner of the frustum can pass without touching it
+    inline bool intersects(const Vec3 &min, const Vec3 &max) const {
+        for (const Vec4 &plane : planes)
+        {
+            // the corner farthest along the normal
+            const float x = plane.x >= 0 ? max.x : min.x;
+            const float y = plane.y >= 0 ? max.y : min.y;
+            const float z = plane.z >= 0 ? max.z : min.z;
+            if (plane.x * x + plane.y * y + plane.z * z + plane.w < 0)
+                return false;
+        }
+        return true;
+    }
+
+    // a box in the space m maps into world space, the planes are brought into that space instead
+    inline bool intersects(const Vec3 &min, const Vec3 &max, const Mat4 &m) const {
+        for (const Vec4 &plane : planes)
+        {
+            const float a = plane.x * m.m00 + plane.y * m.m10 + plane.z * m.m20;
+            const float b = plane.x * m.m01 + plane.y * m.m11 + plane.z * m.m21;
+            const float c = plane.x * m.m02 + plane.y * m.m12 + plane.z * m.m22;
+            const float d = plane.x * m.m03 + plane.y * m.m13 + plane.z * m.m23 + plane.w;
+            if (a * (a >= 0 ? max.x : min.x) + b * (b >= 0 ? max.y : min.y) + c * (c >= 0 ? max.z : min.z) + d < 0)
+                return false;
+        }
+        return true;
+    }
+};
+
 #endif // PGK_MATH_H
@@ -1,103 +1,422 @@
 #include "pgk_obj.h"
+#include "pgk_assets.h"
+#include "pgk_jobsystem.h"
+#include "pgk_simplify.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <array>
+#include <charconv>
+#include <cstring>
 #include <iostream>
 #include <fstream>
+#include <limits>
 #include <sstream>
+#include <string_view>
+#include <unordered_map>
 
-std::vector<Mesh> ObjLoader::loadObj(const std::string &filename) {
+// files below this size are parsed by a single job
+static constexpr size_t PARALLEL_PARSE_SIZE = 1 << 20;
+// triangles per cluster, few enough for narrow normal cones and many enough that the per
+// cluster tests stay cheap next to the vertex work they save
+static constexpr size_t CLUSTER_SIZE = 64;
+// levels of detail halve the triangles until this many are left, below it a level saves less
+// than its selection costs
+static constexpr size_t LOD_MIN_TRIANGLES = 128;
+static constexpr size_t LOD_MAX_LEVELS = 8;
+// negative obj indices count back from the vertices read so far, which a chunk only knows for
+// itself. they are stored as a chunk-local 1-based index offset by RELATIVE_INDEX and resolved
+// once the chunks before it are counted
+static constexpr int RELATIVE_INDEX = std::numeric_limits<int>::min() / 2;
+
+// a face corner as written in the file, 1-based v/vt/vn indices with 0 for a missing one
+struct FaceCorner {
+    int position = 0;
+    int texCoord = 0;
+    int normal = 0;
+
+    bool operator==(const FaceCorner &other) const {
+        return position == other.position && texCoord == other.texCoord && normal == other.normal;
+    }
+};
+
+struct FaceCornerHash {
+    size_t operator()(const FaceCorner &corner) const {
+        size_t hash = std::hash<int>()(corner.position);
+        hash = hash * 31 + std::hash<int>()(corner.texCoord);
+        return hash * 31 + std::hash<int>()(corner.normal);
+    }
+};
+
+// o, mtllib, usemtl and s lines, applied before face `face` of their chunk
+struct ObjDirective {
+    enum class Type { Object, MaterialLibrary, UseMaterial, Smoothing };
+    Type type;
+    size_t face;
+    std::string value;
+};
+
+// everything parsed from one run of whole lines of the file
+struct ObjChunk {
+    std::vector<Vec3> positions;
+    std::vector<Vec3> normals;
+    std::vector<Vec2> texCoords;
+    std::vector<FaceCorner> corners;
+    std::vector<size_t> faceEnds; // face i owns corners [faceEnds[i - 1], faceEnds[i])
+    std::vector<ObjDirective> directives;
+};
+
+// what a mesh cache keeps of the materials, they are resolved from the mtl files on load
+struct MaterialReferences {
+    std::vector<std::string> libraries; // mtllib paths as written in the obj
+    std::vector<std::string> meshMaterials; // per mesh, empty for the default material
+};
+
+// parsed obj files are cached next to the source as <name>.pgkmesh: a header, the material
+// libraries, then every mesh with all its arrays stored exactly as they are held in memory
+static constexpr char MESH_CACHE_MAGIC[8] = {'P', 'G', 'K', 'M', 'E', 'S', 'H', '\0'};
+static constexpr uint32_t MESH_CACHE_VERSION = 4;
+
+struct MeshCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t meshCount;
+    uint32_t libraryCount;
+};
+
+// followed by the name, the material name, vertices, indices, tangents, bitangents, clusters,
+// cluster vertices, the bvh and the levels of detail
+struct MeshCacheEntry {
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    uint32_t clusterCount;
+    uint32_t clusterVertexCount;
+    uint32_t lodCount;
+    uint32_t nameSize;
+    uint32_t materialSize;
+    uint32_t bvhSize;
+    uint32_t smoothShading;
+    Vec3 boundsMin;
+    Vec3 boundsMax;
+    Vec3 boundsCenter;
+    float boundsRadius;
+};
+
+// followed by vertices, indices, tangents, bitangents, clusters and cluster vertices
+struct MeshCacheLod {
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    uint32_t clusterCount;
+    uint32_t clusterVertexCount;
+    float error;
+    Vec3 boundsMin;
+    Vec3 boundsMax;
+    Vec3 boundsCenter;
+    float boundsRadius;
+};
+
+// reads from the mapped cache, every read fails once the data runs out
+struct MeshCacheReader {
+    const char *position;
+    const char *end;
+
+    template <typename T>
+    bool read(T *values, size_t count) {
+        if (static_cast<size_t>(end - position) / sizeof(T) < count)
+            return false;
+        if (count > 0)
+            std::memcpy(values, position, count * sizeof(T));
+        position += count * sizeof(T);
+        return true;
+    }
+
+    template <typename T>
+    bool read(std::vector<T> &values, size_t count) {
+        if (static_cast<size_t>(end - position) / sizeof(T) < count)
+            return false;
+        values.resize(count);
+        return read(values.data(), count);
+    }
+
+    bool read(std::string &value, size_t size) {
+        if (static_cast<size_t>(end - position) < size)
+            return false;
+        value.assign(position, size);
+        position += size;
+        return true;
+    }
+};
+
+template <typename T>
+static void appendCacheData(std::vector<char> &data, const T *values, size_t count) {
+    const char *bytes = reinterpret_cast<const char *>(values);
+    data.insert(data.end(), bytes, bytes + count * sizeof(T));
+}
+
+// the arrays every mesh and level of detail stores, in cache order
+static void appendMeshArrays(std::vector<char> &data, const Mesh &mesh) {
+    appendCacheData(data, mesh.vertices.data(), mesh.vertices.size());
+    appendCacheData(data, mesh.indices.data(), mesh.indices.size());
+    appendCacheData(data, mesh.tangents.data(), mesh.tangents.size());
+    appendCacheData(data, mesh.bitangents.data(), mesh.bitangents.size());
+    appendCacheData(data, mesh.clusters.data(), mesh.clusters.size());
+    appendCacheData(data, mesh.clusterVertices.data(), mesh.clusterVertices.size());
+}
+
+// false when the data runs out or an index or cluster points outside the mesh
+static bool readMeshArrays(MeshCacheReader &reader, Mesh &mesh, uint32_t vertexCount, uint32_t indexCount, uint32_t clusterCount, uint32_t clusterVertexCount) {
+    if (indexCount % 3 != 0
+        || !reader.read(mesh.vertices, vertexCount) || !reader.read(mesh.indices, indexCount)
+        || !reader.read(mesh.tangents, indexCount / 3) || !reader.read(mesh.bitangents, indexCount / 3)
+        || !reader.read(mesh.clusters, clusterCount) || !reader.read(mesh.clusterVertices, clusterVertexCount))
+        return false;
+    for (const unsigned int index : mesh.indices) {
+        if (index >= vertexCount)
+            return false;
+    }
+    for (const unsigned int vertex : mesh.clusterVertices) {
+        if (vertex >= vertexCount)
+            return false;
+    }
+    for (const MeshCluster &cluster : mesh.clusters) {
+        if (cluster.firstIndex > indexCount || cluster.indexCount > indexCount - cluster.firstIndex || cluster.indexCount % 3 != 0
+            || cluster.firstVertex > clusterVertexCount || cluster.vertexCount > clusterVertexCount - cluster.firstVertex)
+            return false;
+    }
+    return true;
+}
+
+static bool isSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static std::string_view nextToken(const char *&p, const char *end) {
+    while (p < end && isSpace(*p))
+        ++p;
+    const char *begin = p;
+    while (p < end && !isSpace(*p))
+        ++p;
+    return std::string_view(begin, p - begin);
+}
+
+// missing or malformed values are left at 0
+static void parseFloats(const char *p, const char *end, float *values, int count) {
+    for (int i = 0; i < count; ++i) {
+        while (p < end && isSpace(*p))
+            ++p;
+        if (p < end && *p == '+')
+            ++p;
+        const auto result = std::from_chars(p, end, values[i]);
+        if (result.ec != std::errc())
+            return;
+        p = result.ptr;
+    }
+}
+
+static int parseIndex(const char *&p, const char *end, size_t count) {
+    int index = 0;
+    const auto result = std::from_chars(p, end, index);
+    if (result.ec != std::errc())
+        return 0;
+    p = result.ptr;
+    return index < 0 ? static_cast<int>(count) + index + 1 + RELATIVE_INDEX : index;
+}
+
+// the 1-based index into a list of count elements, 0 if it is missing or out of range
+static int resolveIndex(int index, size_t before, size_t count) {
+    if (index < 0)
+        index = static_cast<int>(before) + (index - RELATIVE_INDEX);
+    return index > 0 && static_cast<size_t>(index) <= count ? index : 0;
+}
+
+static void parseChunk(const char *p, const char *end, ObjChunk &chunk) {
+    while (p < end) {
+        const char *lineEnd = static_cast<const char *>(std::memchr(p, '\n', end - p));
+        if (!lineEnd)
+            lineEnd = end;
+        const char *cursor = p;
+        const std::string_view type = nextToken(cursor, lineEnd);
+
+        if (type == "v") {
+            float values[3] = {};
+            parseFloats(cursor, lineEnd, values, 3);
+            chunk.positions.push_back(Vec3(values[0], values[1], values[2]));
+        } else if (type == "vn") {
+            float values[3] = {};
+            parseFloats(cursor, lineEnd, values, 3);
+            chunk.normals.push_back(Vec3(values[0], values[1], values[2]));
+        } else if (type == "vt") {
+            float values[2] = {};
+            parseFloats(cursor, lineEnd, values, 2);
+            chunk.texCoords.push_back(Vec2(values[0], 1.0f - values[1])); // Flip V coordinate
+        } else if (type == "f") {
+            for (std::string_view token = nextToken(cursor, lineEnd); !token.empty(); token = nextToken(cursor, lineEnd)) {
+                const char *q = token.data();
+                const char *tokenEnd = q + token.size();
+                FaceCorner corner;
+                corner.position = parseIndex(q, tokenEnd, chunk.positions.size());
+                if (q < tokenEnd && *q == '/') {
+                    ++q;
+                    corner.texCoord = parseIndex(q, tokenEnd, chunk.texCoords.size());
+                }
+                if (q < tokenEnd && *q == '/') {
+                    ++q;
+                    corner.normal = parseIndex(q, tokenEnd, chunk.normals.size());
+                }
+                chunk.corners.push_back(corner);
+            }
+            chunk.faceEnds.push_back(chunk.corners.size());
+        } else if (type == "o" || type == "mtllib" || type == "usemtl" || type == "s") {
+            const ObjDirective::Type directive = type == "o" ? ObjDirective::Type::Object
+                                               : type == "mtllib" ? ObjDirective::Type::MaterialLibrary
+                                               : type == "usemtl" ? ObjDirective::Type::UseMaterial
+                                                                  : ObjDirective::Type::Smoothing;
+            chunk.directives.push_back({directive, chunk.faceEnds.size(), std::string(nextToken(cursor, lineEnd))});
+        }
+        p = lineEnd < end ? lineEnd + 1 : end;
+    }
+}
+
+static std::vector<Mesh> parseObj(const std::string &filename, const std::string &basePath, MaterialReferences &references) {
     std::vector<Mesh> meshes;
-    std::ifstream file(filename);
-    if (!file.is_open()) {
+    QFile file(QString::fromStdString(filename));
+    if (!file.open(QIODevice::ReadOnly)) {
         std::cerr << "Could not open file " << filename << std::endl;
         return meshes;
     }
 
-    size_t lastSlash = filename.find_last_of("/\\");
-    std::string basePath = (lastSlash != std::string::npos) ? filename.substr(0, lastSlash + 1) : "";
+    // the file is mapped rather than read, reading is only the fallback
+    size_t size = file.size();
+    const char *data = reinterpret_cast<const char *>(size > 0 ? file.map(0, size) : nullptr);
+    QByteArray contents;
+    if (!data) {
+        contents = file.readAll();
+        data = contents.constData();
+        size = contents.size();
+    }
+    const char *end = data + size;
+
+    // split at line boundaries and tokenize the chunks in parallel
+    const size_t chunkCount = size < PARALLEL_PARSE_SIZE ? 1 : PGK_JobSystem::instance().getThreadCount() * 4;
+    std::vector<const char *> chunkBounds(chunkCount + 1, end);
+    chunkBounds[0] = data;
+    for (size_t i = 1; i < chunkCount; ++i) {
+        const char *split = std::max(chunkBounds[i - 1], data + size / chunkCount * i);
+        const char *lineEnd = static_cast<const char *>(std::memchr(split, '\n', end - split));
+        chunkBounds[i] = lineEnd ? lineEnd + 1 : end;
+    }
+    std::vector<ObjChunk> chunks(chunkCount);
+    PGK_JobSystem::instance().parallelFor(chunkCount, 1, [&](size_t begin, size_t last) {
+        for (size_t i = begin; i < last; ++i) {
+            parseChunk(chunkBounds[i], chunkBounds[i + 1], chunks[i]);
+        }
+    });
 
+    // merge the vertex data, remembering how much came before every chunk
     std::vector<Vec3> positions;
     std::vector<Vec3> normals;
     std::vector<Vec2> texCoords;
-    std::map<std::string, Material> mtlMaterials;
+    std::vector<std::array<size_t, 3>> countsBefore(chunkCount);
+    for (size_t i = 0; i < chunkCount; ++i) {
+        countsBefore[i] = {positions.size(), texCoords.size(), normals.size()};
+        positions.insert(positions.end(), chunks[i].positions.begin(), chunks[i].positions.end());
+        texCoords.insert(texCoords.end(), chunks[i].texCoords.begin(), chunks[i].texCoords.end());
+        normals.insert(normals.end(), chunks[i].normals.begin(), chunks[i].normals.end());
+    }
 
+    std::map<std::string, Material> mtlMaterials;
     std::string currentObject;
     std::string currentMtlName;
     bool currentSmooth = false;
     Mesh currentMesh;
+    std::string currentMeshMaterial;
+    // vertex of every distinct corner in currentMesh, faces share vertices through it
+    std::unordered_map<FaceCorner, unsigned int, FaceCornerHash> cornerVertices;
+    std::vector<unsigned int> faceVertices;
 
     auto finalizeMesh = [&]() {
         if (!currentMesh.vertices.empty()) {
             meshes.push_back(currentMesh);
+            references.meshMaterials.push_back(currentMeshMaterial);
             currentMesh = Mesh();
+            currentMeshMaterial.clear();
         }
+        cornerVertices.clear();
     };
 
-    std::string line;
-    while (std::getline(file, line)) {
-        std::istringstream iss(line);
-        std::string type;
-        iss >> type;
-
-        if (type == "o") {
-            std::string objectName;
-            iss >> objectName;
-            if (objectName != currentObject) {
+    auto applyDirective = [&](const ObjDirective &directive) {
+        switch (directive.type) {
+        case ObjDirective::Type::Object:
+            if (directive.value != currentObject) {
                 finalizeMesh();
-                currentObject = objectName;
+                currentObject = directive.value;
                 currentMesh.name = currentObject;
             }
-        } else if (type == "mtllib") {
-            std::string mtlFile;
-            iss >> mtlFile;
-            parseMtlFile(basePath + mtlFile, mtlMaterials, basePath);
-        } else if (type == "usemtl") {
-            std::string mtlName;
-            iss >> mtlName;
-            if (mtlName != currentMtlName) {
+            break;
+        case ObjDirective::Type::MaterialLibrary:
+            ObjLoader::parseMtlFile(basePath + directive.value, mtlMaterials, basePath);
+            references.libraries.push_back(directive.value);
+            break;
+        case ObjDirective::Type::UseMaterial:
+            if (directive.value != currentMtlName) {
                 finalizeMesh();
-                currentMtlName = mtlName;
+                currentMtlName = directive.value;
                 if (mtlMaterials.count(currentMtlName)) {
                     currentMesh.material = mtlMaterials[currentMtlName];
+                    currentMeshMaterial = currentMtlName;
                 }
             }
-        } else if (type == "s") {
-            std::string sVal;
-            iss >> sVal;
-            bool newSmooth = (sVal != "off");
+            break;
+        case ObjDirective::Type::Smoothing: {
+            bool newSmooth = (directive.value != "off");
             if (newSmooth != currentSmooth) {
                 finalizeMesh();
                 currentSmooth = newSmooth;
             }
             currentMesh.material.smoothShading = currentSmooth;
-        } else if (type == "v") {
-            Vec3 pos;
-            iss >> pos.x >> pos.y >> pos.z;
-            positions.push_back(pos);
-        } else if (type == "vn") {
-            Vec3 norm;
-            iss >> norm.x >> norm.y >> norm.z;
-            normals.push_back(norm);
-        } else if (type == "vt") {
-            Vec2 tex;
-            iss >> tex.x >> tex.y;
-            tex.y = 1.0f - tex.y; // Flip V coordinate
-            texCoords.push_back(tex);
-        } else if (type == "f") {
-            std::vector<Vertex> faceVertices;
-            std::string vert;
-            while (iss >> vert) {
-                std::istringstream vss(vert);
-                std::string v, vt, vn;
-                std::getline(vss, v, '/');
-                std::getline(vss, vt, '/');
-                std::getline(vss, vn, '/');
-
-                Vertex vertex;
-                if (!v.empty()) vertex.position = positions[std::stoi(v) - 1];
-                if (!vt.empty()) vertex.texCoord = texCoords[std::stoi(vt) - 1];
-                if (!vn.empty()) vertex.normal = normals[std::stoi(vn) - 1];
-
-                currentMesh.vertices.push_back(vertex);
-                currentMesh.indices.push_back(currentMesh.vertices.size() - 1);
+            break;
+        }
+        }
+    };
+
+    // the meshes themselves, in file order
+    for (size_t c = 0; c < chunkCount; ++c) {
+        const ObjChunk &chunk = chunks[c];
+        const std::array<size_t, 3> &before = countsBefore[c];
+        size_t directive = 0;
+        size_t cornerBegin = 0;
+        for (size_t face = 0; face <= chunk.faceEnds.size(); ++face) {
+            while (directive < chunk.directives.size() && chunk.directives[directive].face == face) {
+                applyDirective(chunk.directives[directive++]);
+            }
+            if (face == chunk.faceEnds.size())
+                break;
+
+            faceVertices.clear();
+            for (size_t i = cornerBegin; i < chunk.faceEnds[face]; ++i) {
+                FaceCorner corner;
+                corner.position = resolveIndex(chunk.corners[i].position, before[0], positions.size());
+                corner.texCoord = resolveIndex(chunk.corners[i].texCoord, before[1], texCoords.size());
+                corner.normal = resolveIndex(chunk.corners[i].normal, before[2], normals.size());
+
+                const auto inserted = cornerVertices.emplace(corner, static_cast<unsigned int>(currentMesh.vertices.size()));
+                if (inserted.second) {
+                    Vertex vertex;
+                    if (corner.position) vertex.position = positions[corner.position - 1];
+                    if (corner.texCoord) vertex.texCoord = texCoords[corner.texCoord - 1];
+                    if (corner.normal) vertex.normal = normals[corner.normal - 1];
+                    currentMesh.vertices.push_back(vertex);
+                }
+                faceVertices.push_back(inserted.first->second);
+            }
+            cornerBegin = chunk.faceEnds[face];
+
+            // polygons are split into a fan around their first corner
+            for (size_t i = 1; i + 1 < faceVertices.size(); ++i) {
+                currentMesh.indices.push_back(faceVertices[0]);
+                currentMesh.indices.push_back(faceVertices[i]);
+                currentMesh.indices.push_back(faceVertices[i + 1]);
             }
         }
     }
@@ -106,6 +425,400 @@ std::vector<Mesh> ObjLoader::loadObj(const std::string &filename) {
     return meshes;
 }
 
+static std::string meshCachePath(const std::string &filename) {
+    const size_t dot = filename.find_last_of('.');
+    const size_t lastSlash = filename.find_last_of("/\\");
+    const bool hasExtension = dot != std::string::npos && (lastSlash == std::string::npos || dot > lastSlash);
+    return (hasExtension ? filename.substr(0, dot) : filename) + ".pgkmesh";
+}
+
+static bool readMeshCache(const std::string &cachePath, const std::string &basePath, std::vector<Mesh> &meshes) {
+    QFile file(QString::fromStdString(cachePath));
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    const size_t size = file.size();
+    const char *data = reinterpret_cast<const char *>(size > 0 ? file.map(0, size) : nullptr);
+    if (!data)
+        return false;
+
+    MeshCacheReader reader = {data, data + size};
+    MeshCacheHeader header;
+    if (!reader.read(&header, 1) || std::memcmp(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic)) != 0 || header.version != MESH_CACHE_VERSION)
+        return false;
+
+    MaterialReferences references;
+    references.libraries.resize(header.libraryCount);
+    for (auto &library : references.libraries) {
+        uint32_t librarySize;
+        if (!reader.read(&librarySize, 1) || !reader.read(library, librarySize))
+            return false;
+    }
+
+    // everything is checked before anything is used, a damaged cache is parsed again
+    std::vector<Mesh> loaded;
+    std::vector<bool> smoothShading;
+    for (uint32_t m = 0; m < header.meshCount; ++m) {
+        MeshCacheEntry entry;
+        Mesh mesh;
+        std::string material;
+        if (!reader.read(&entry, 1) || entry.lodCount > LOD_MAX_LEVELS
+            || !reader.read(mesh.name, entry.nameSize) || !reader.read(material, entry.materialSize)
+            || !readMeshArrays(reader, mesh, entry.vertexCount, entry.indexCount, entry.clusterCount, entry.clusterVertexCount)
+            || static_cast<size_t>(reader.end - reader.position) < entry.bvhSize)
+            return false;
+
+        auto bvh = std::make_shared<PGK_BVH>();
+        if (!bvh->deserialize(mesh.bvhTriangles(), reader.position, entry.bvhSize))
+            return false;
+        reader.position += entry.bvhSize;
+        mesh.bvh = bvh;
+
+        mesh.lods.resize(entry.lodCount);
+        for (Mesh &lod : mesh.lods) {
+            MeshCacheLod lodEntry;
+            if (!reader.read(&lodEntry, 1)
+                || !readMeshArrays(reader, lod, lodEntry.vertexCount, lodEntry.indexCount, lodEntry.clusterCount, lodEntry.clusterVertexCount))
+                return false;
+            lod.name = mesh.name;
+            lod.lodError = lodEntry.error;
+            lod.boundsMin = lodEntry.boundsMin;
+            lod.boundsMax = lodEntry.boundsMax;
+            lod.boundsCenter = lodEntry.boundsCenter;
+            lod.boundsRadius = lodEntry.boundsRadius;
+        }
+        mesh.boundsMin = entry.boundsMin;
+        mesh.boundsMax = entry.boundsMax;
+        mesh.boundsCenter = entry.boundsCenter;
+        mesh.boundsRadius = entry.boundsRadius;
+        loaded.push_back(std::move(mesh));
+        references.meshMaterials.push_back(material);
+        smoothShading.push_back(entry.smoothShading != 0);
+    }
+    if (reader.position != reader.end)
+        return false;
+
+    std::map<std::string, Material> mtlMaterials;
+    for (const auto &library : references.libraries) {
+        ObjLoader::parseMtlFile(basePath + library, mtlMaterials, basePath);
+    }
+    for (size_t m = 0; m < loaded.size(); ++m) {
+        const auto material = mtlMaterials.find(references.meshMaterials[m]);
+        if (!references.meshMaterials[m].empty() && material != mtlMaterials.end()) {
+            loaded[m].material = material->second;
+        }
+        loaded[m].material.smoothShading = smoothShading[m];
+    }
+    meshes = std::move(loaded);
+    return true;
+}
+
+static void writeMeshCache(const std::string &cachePath, const std::vector<Mesh> &meshes, const MaterialReferences &references) {
+    std::vector<char> data;
+    MeshCacheHeader header;
+    std::memcpy(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic));
+    header.version = MESH_CACHE_VERSION;
+    header.meshCount = static_cast<uint32_t>(meshes.size());
+    header.libraryCount = static_cast<uint32_t>(references.libraries.size());
+    appendCacheData(data, &header, 1);
+    for (const auto &library : references.libraries) {
+        const uint32_t librarySize = static_cast<uint32_t>(library.size());
+        appendCacheData(data, &librarySize, 1);
+        appendCacheData(data, library.data(), library.size());
+    }
+
+    std::vector<char> bvhData;
+    for (size_t m = 0; m < meshes.size(); ++m) {
+        const Mesh &mesh = meshes[m];
+        const std::string &material = references.meshMaterials[m];
+        bvhData.clear();
+        mesh.bvh->serialize(bvhData);
+
+        MeshCacheEntry entry;
+        entry.vertexCount = static_cast<uint32_t>(mesh.vertices.size());
+        entry.indexCount = static_cast<uint32_t>(mesh.indices.size());
+        entry.clusterCount = static_cast<uint32_t>(mesh.clusters.size());
+        entry.clusterVertexCount = static_cast<uint32_t>(mesh.clusterVertices.size());
+        entry.lodCount = static_cast<uint32_t>(mesh.lods.size());
+        entry.nameSize = static_cast<uint32_t>(mesh.name.size());
+        entry.materialSize = static_cast<uint32_t>(material.size());
+        entry.bvhSize = static_cast<uint32_t>(bvhData.size());
+        entry.smoothShading = mesh.material.smoothShading ? 1 : 0;
+        entry.boundsMin = mesh.boundsMin;
+        entry.boundsMax = mesh.boundsMax;
+        entry.boundsCenter = mesh.boundsCenter;
+        entry.boundsRadius = mesh.boundsRadius;
+        appendCacheData(data, &entry, 1);
+        appendCacheData(data, mesh.name.data(), mesh.name.size());
+        appendCacheData(data, material.data(), material.size());
+        appendMeshArrays(data, mesh);
+        appendCacheData(data, bvhData.data(), bvhData.size());
+
+        for (const Mesh &lod : mesh.lods) {
+            MeshCacheLod lodEntry;
+            lodEntry.vertexCount = static_cast<uint32_t>(lod.vertices.size());
+            lodEntry.indexCount = static_cast<uint32_t>(lod.indices.size());
+            lodEntry.clusterCount = static_cast<uint32_t>(lod.clusters.size());
+            lodEntry.clusterVertexCount = static_cast<uint32_t>(lod.clusterVertices.size());
+            lodEntry.error = lod.lodError;
+            lodEntry.boundsMin = lod.boundsMin;
+            lodEntry.boundsMax = lod.boundsMax;
+            lodEntry.boundsCenter = lod.boundsCenter;
+            lodEntry.boundsRadius = lod.boundsRadius;
+            appendCacheData(data, &lodEntry, 1);
+            appendMeshArrays(data, lod);
+        }
+    }
+
+    // written to a temporary file and renamed, readers never see half a cache
+    QSaveFile file(QString::fromStdString(cachePath));
+    if (!file.open(QIODevice::WriteOnly) || file.write(data.data(), data.size()) != static_cast<qint64>(data.size()) || !file.commit()) {
+        std::cerr << "Could not write mesh cache " << cachePath << std::endl;
+    }
+}
+
+std::vector<Mesh> ObjLoader::loadObj(const std::string &filename) {
+    size_t lastSlash = filename.find_last_of("/\\");
+    std::string basePath = (lastSlash != std::string::npos) ? filename.substr(0, lastSlash + 1) : "";
+
+    // the cache is used while it is newer than the obj
+    std::vector<Mesh> meshes;
+    const std::string cachePath = meshCachePath(filename);
+    const QFileInfo source(QString::fromStdString(filename));
+    const QFileInfo cache(QString::fromStdString(cachePath));
+    if (source.exists() && cache.exists() && cache.lastModified() > source.lastModified() && readMeshCache(cachePath, basePath, meshes))
+        return meshes;
+
+    MaterialReferences references;
+    meshes = parseObj(filename, basePath, references);
+    for (auto &mesh : meshes) {
+        computeBounds(mesh);
+        buildClusters(mesh);
+        buildTangents(mesh);
+        buildBVH(mesh);
+        buildLods(mesh);
+    }
+    if (!meshes.empty())
+        writeMeshCache(cachePath, meshes, references);
+    return meshes;
+}
+
+void ObjLoader::buildClusters(Mesh &mesh) {
+    const size_t triangleCount = mesh.indices.size() / 3;
+
+    // the triangles around every vertex
+    std::vector<uint32_t> vertexTriangleStart(mesh.vertices.size() + 1, 0);
+    for (const unsigned int index : mesh.indices) {
+        vertexTriangleStart[index + 1]++;
+    }
+    for (size_t v = 0; v < mesh.vertices.size(); ++v) {
+        vertexTriangleStart[v + 1] += vertexTriangleStart[v];
+    }
+    std::vector<uint32_t> vertexTriangles(mesh.indices.size());
+    std::vector<uint32_t> fill(vertexTriangleStart.begin(), vertexTriangleStart.end() - 1);
+    for (size_t i = 0; i < mesh.indices.size(); ++i) {
+        vertexTriangles[fill[mesh.indices[i]]++] = static_cast<uint32_t>(i / 3);
+    }
+
+    // unit length, zero for degenerate triangles
+    std::vector<Vec3> normals(triangleCount);
+    for (size_t t = 0; t < triangleCount; ++t) {
+        const Vec3 &a = mesh.vertices[mesh.indices[t * 3]].position;
+        const Vec3 &b = mesh.vertices[mesh.indices[t * 3 + 1]].position;
+        const Vec3 &c = mesh.vertices[mesh.indices[t * 3 + 2]].position;
+        const Vec3 normal = (b - a).cross(c - a);
+        const float length = normal.length();
+        normals[t] = length > 0 ? normal / length : Vec3();
+    }
+
+    // clusters grow from a seed over shared vertices, always taking the neighbour that is most
+    // aligned with the normals so far so the cones stay narrow. a cluster that runs out of
+    // neighbours continues with the next triangle in file order
+    std::vector<unsigned int> indices;
+    indices.reserve(mesh.indices.size());
+    std::vector<uint32_t> candidateOf(triangleCount, std::numeric_limits<uint32_t>::max());
+    std::vector<uint32_t> vertexOf(mesh.vertices.size(), std::numeric_limits<uint32_t>::max());
+    std::vector<char> assigned(triangleCount, 0);
+    std::vector<uint32_t> triangles;
+    std::vector<uint32_t> candidates;
+    mesh.clusters.clear();
+    mesh.clusterVertices.clear();
+    size_t nextSeed = 0;
+    while (true) {
+        while (nextSeed < triangleCount && assigned[nextSeed]) {
+            ++nextSeed;
+        }
+        if (nextSeed == triangleCount)
+            break;
+
+        const uint32_t clusterId = static_cast<uint32_t>(mesh.clusters.size());
+        triangles.clear();
+        candidates.clear();
+        Vec3 normalSum;
+        uint32_t triangle = static_cast<uint32_t>(nextSeed);
+        while (true) {
+            assigned[triangle] = 1;
+            triangles.push_back(triangle);
+            normalSum += normals[triangle];
+            if (triangles.size() == CLUSTER_SIZE)
+                break;
+
+            for (int k = 0; k < 3; ++k) {
+                const unsigned int vertex = mesh.indices[triangle * 3 + k];
+                for (uint32_t n = vertexTriangleStart[vertex]; n < vertexTriangleStart[vertex + 1]; ++n) {
+                    const uint32_t neighbour = vertexTriangles[n];
+                    if (!assigned[neighbour] && candidateOf[neighbour] != clusterId) {
+                        candidateOf[neighbour] = clusterId;
+                        candidates.push_back(neighbour);
+                    }
+                }
+            }
+
+            float bestAlignment = std::numeric_limits<float>::lowest();
+            size_t best = candidates.size();
+            for (size_t c = 0; c < candidates.size(); ++c) {
+                const float alignment = normals[candidates[c]].dot(normalSum);
+                if (alignment > bestAlignment) {
+                    bestAlignment = alignment;
+                    best = c;
+                }
+            }
+            if (best < candidates.size()) {
+                triangle = candidates[best];
+                candidates[best] = candidates.back();
+                candidates.pop_back();
+                continue;
+            }
+            while (nextSeed < triangleCount && assigned[nextSeed]) {
+                ++nextSeed;
+            }
+            if (nextSeed == triangleCount)
+                break;
+            triangle = static_cast<uint32_t>(nextSeed);
+        }
+
+        MeshCluster cluster;
+        cluster.firstIndex = static_cast<uint32_t>(indices.size());
+        cluster.indexCount = static_cast<uint32_t>(triangles.size() * 3);
+        cluster.firstVertex = static_cast<uint32_t>(mesh.clusterVertices.size());
+        cluster.boundsMin = cluster.boundsMax = mesh.vertices[mesh.indices[triangles[0] * 3]].position;
+        for (const uint32_t t : triangles) {
+            for (int k = 0; k < 3; ++k) {
+                const unsigned int vertex = mesh.indices[t * 3 + k];
+                indices.push_back(vertex);
+                if (vertexOf[vertex] == clusterId)
+                    continue;
+                vertexOf[vertex] = clusterId;
+                mesh.clusterVertices.push_back(vertex);
+                const Vec3 &position = mesh.vertices[vertex].position;
+                cluster.boundsMin = Vec3(std::min(cluster.boundsMin.x, position.x), std::min(cluster.boundsMin.y, position.y), std::min(cluster.boundsMin.z, position.z));
+                cluster.boundsMax = Vec3(std::max(cluster.boundsMax.x, position.x), std::max(cluster.boundsMax.y, position.y), std::max(cluster.boundsMax.z, position.z));
+            }
+        }
+        cluster.vertexCount = static_cast<uint32_t>(mesh.clusterVertices.size()) - cluster.firstVertex;
+
+        cluster.center = (cluster.boundsMin + cluster.boundsMax) * 0.5f;
+        float radiusSq = 0;
+        for (uint32_t v = cluster.firstVertex; v < cluster.firstVertex + cluster.vertexCount; ++v) {
+            radiusSq = std::max(radiusSq, cluster.center.distanceSq(mesh.vertices[mesh.clusterVertices[v]].position));
+        }
+        cluster.radius = std::sqrt(radiusSq);
+
+        // the cone around the average normal, it only culls while its half angle is below 90 degrees
+        const float normalLength = normalSum.length();
+        cluster.coneAxis = normalLength > 0 ? normalSum / normalLength : Vec3(0, 0, 1);
+        float minAlignment = normalLength > 0 ? 1.0f : -1.0f;
+        for (const uint32_t t : triangles) {
+            if (normals[t] != Vec3())
+                minAlignment = std::min(minAlignment, normals[t].dot(cluster.coneAxis));
+        }
+        cluster.coneCutoff = minAlignment > 0 ? std::sqrt(1 - minAlignment * minAlignment) : 2.0f;
+        mesh.clusters.push_back(cluster);
+    }
+    mesh.indices = std::move(indices);
+}
+
+void ObjLoader::buildBVH(Mesh &mesh) {
+    auto bvh = std::make_shared<PGK_BVH>();
+    bvh->build(mesh.bvhTriangles());
+    mesh.bvh = bvh;
+}
+
+void ObjLoader::buildLods(Mesh &mesh) {
+    mesh.lods.clear();
+    std::vector<size_t> targets;
+    for (size_t triangles = mesh.indices.size() / 6; triangles >= LOD_MIN_TRIANGLES && targets.size() < LOD_MAX_LEVELS; triangles /= 2) {
+        targets.push_back(triangles);
+    }
+    if (targets.empty())
+        return;
+
+    // every level keeps only the vertices its triangles use
+    std::vector<unsigned int> remap(mesh.vertices.size());
+    for (const PGK_Simplify::Level &level : PGK_Simplify::simplify(mesh.vertices, mesh.indices, targets)) {
+        Mesh lod;
+        lod.name = mesh.name;
+        lod.lodError = level.error;
+        lod.indices.reserve(level.indices.size());
+        std::fill(remap.begin(), remap.end(), std::numeric_limits<unsigned int>::max());
+        for (const unsigned int index : level.indices) {
+            if (remap[index] == std::numeric_limits<unsigned int>::max()) {
+                remap[index] = static_cast<unsigned int>(lod.vertices.size());
+                lod.vertices.push_back(mesh.vertices[index]);
+            }
+            lod.indices.push_back(remap[index]);
+        }
+        computeBounds(lod);
+        buildClusters(lod);
+        buildTangents(lod);
+        mesh.lods.push_back(std::move(lod));
+    }
+}
+
+void ObjLoader::buildTangents(Mesh &mesh) {
+    const size_t triangleCount = mesh.indices.size() / 3;
+    mesh.tangents.resize(triangleCount);
+    mesh.bitangents.resize(triangleCount);
+    for (size_t t = 0; t < triangleCount; ++t) {
+        const Vertex &a = mesh.vertices[mesh.indices[t * 3]];
+        const Vertex &b = mesh.vertices[mesh.indices[t * 3 + 1]];
+        const Vertex &c = mesh.vertices[mesh.indices[t * 3 + 2]];
+
+        // Compute edges and UV deltas for normal mapping
+        Vec3 edge1 = b.position - a.position;
+        Vec3 edge2 = c.position - a.position;
+        Vec2 deltaUV1 = b.texCoord - a.texCoord;
+        Vec2 deltaUV2 = c.texCoord - a.texCoord;
+
+        float f = 1.0f / (deltaUV1.x * deltaUV2.y - deltaUV2.x * deltaUV1.y);
+
+        mesh.tangents[t] = f * (edge1 * deltaUV2.y - edge2 * deltaUV1.y);
+        mesh.bitangents[t] = f * (edge2 * deltaUV1.x - edge1 * deltaUV2.x);
+        mesh.tangents[t].normalize();
+        mesh.bitangents[t].normalize();
+    }
+}
+
+void ObjLoader::computeBounds(Mesh &mesh) {
+    if (mesh.vertices.empty()) {
+        mesh.boundsMin = mesh.boundsMax = mesh.boundsCenter = Vec3();
+        mesh.boundsRadius = 0;
+        return;
+    }
+    mesh.boundsMin = mesh.boundsMax = mesh.vertices[0].position;
+    for (const Vertex &vertex : mesh.vertices) {
+        mesh.boundsMin = Vec3(std::min(mesh.boundsMin.x, vertex.position.x), std::min(mesh.boundsMin.y, vertex.position.y), std::min(mesh.boundsMin.z, vertex.position.z));
+        mesh.boundsMax = Vec3(std::max(mesh.boundsMax.x, vertex.position.x), std::max(mesh.boundsMax.y, vertex.position.y), std::max(mesh.boundsMax.z, vertex.position.z));
+    }
+
+    // centered on the box, the radius reaches the farthest vertex instead of the box corners
+    mesh.boundsCenter = (mesh.boundsMin + mesh.boundsMax) * 0.5f;
+    float radiusSq = 0;
+    for (const Vertex &vertex : mesh.vertices) {
+        radiusSq = std::max(radiusSq, mesh.boundsCenter.distanceSq(vertex.position));
+    }
+    mesh.boundsRadius = std::sqrt(radiusSq);
+}
+
 void ObjLoader::parseMtlFile(const std::string& filename, std::map<std::string, Material>& materials, const std::string& basePath) {
     std::ifstream file(filename);
     if (!file.is_open()) {
@@ -117,6 +830,15 @@ void ObjLoader::parseMtlFile(const std::string& filename, std::map<std::string,
     std::string currentMtlName;
     std::string line;
 
+    // maps are collected while parsing and loaded together once the materials are known
+    struct TextureSlot {
+        std::string material;
+        std::shared_ptr<const QImage> Material::*texture;
+        bool Material::*hasTexture;
+        std::string path;
+    };
+    std::vector<TextureSlot> textures;
+
     while (std::getline(file, line)) {
         std::istringstream iss(line);
         std::string type;
@@ -139,58 +861,48 @@ void ObjLoader::parseMtlFile(const std::string& filename, std::map<std::string,
         } else if (type == "map_Kd" || type == "map_Ka") { //ambient or diffuse texture
             std::string texFile;
             iss >> texFile;
-            std::shared_ptr<QImage> newTexture = std::make_shared<QImage>(QString::fromStdString(basePath + texFile));
-            if (newTexture && !newTexture->isNull()) {
-                currentMtl.texture = newTexture;
-                currentMtl.hasTexture = true;
-            }
+            textures.push_back({currentMtlName, &Material::texture, &Material::hasTexture, basePath + texFile});
         } else if (type == "map_Bump" || type == "bump" || type == "map_bump") { //normal map
             std::string bmParameter;
             iss >> bmParameter;
             if(bmParameter == "-bm") iss >> currentMtl.normalMapStrength;
             std::string normalMapFile;
             iss >> normalMapFile;
-            std::shared_ptr<QImage> normalMap = std::make_shared<QImage>(QString::fromStdString(basePath + normalMapFile));
-            if (normalMap && !normalMap->isNull()) {
-                currentMtl.normalMap = normalMap;
-                currentMtl.hasNormalMap = true;
-            }
+            textures.push_back({currentMtlName, &Material::normalMap, &Material::hasNormalMap, basePath + normalMapFile});
         } else if (type == "map_Ks") { // specular color map
             std::string specularMapFile;
             iss >> specularMapFile;
-            std::shared_ptr<QImage> specularMap = std::make_shared<QImage>(QString::fromStdString(basePath + specularMapFile));
-            if (specularMap && !specularMap->isNull()) {
-                currentMtl.specularMap = specularMap;
-                currentMtl.hasSpecularMap = true;
-            }
+            textures.push_back({currentMtlName, &Material::specularMap, &Material::hasSpecularMap, basePath + specularMapFile});
         } else if (type == "map_Ns") { // specular highlight map
             std::string specularHighlightMapFile;
             iss >> specularHighlightMapFile;
-            std::shared_ptr<QImage> specularHighlightMap = std::make_shared<QImage>(QString::fromStdString(basePath + specularHighlightMapFile));
-            if (specularHighlightMap && !specularHighlightMap->isNull()) {
-                currentMtl.specularHighlightMap = specularHighlightMap;
-                currentMtl.hasSpecularHighlightMap = true;
-            }
+            textures.push_back({currentMtlName, &Material::specularHighlightMap, &Material::hasSpecularHighlightMap, basePath + specularHighlightMapFile});
         } else if (type == "map_d") { // alpha map
             std::string alphaMapFile;
             iss >> alphaMapFile;
-            std::shared_ptr<QImage> alphaMap = std::make_shared<QImage>(QString::fromStdString(basePath + alphaMapFile));
-            if (alphaMap && !alphaMap->isNull()) {
-                currentMtl.alphaMap = alphaMap;
-                currentMtl.hasAlphaMap = true;
-            }
+            textures.push_back({currentMtlName, &Material::alphaMap, &Material::hasAlphaMap, basePath + alphaMapFile});
         } else if (type == "disp") { // displacement map
             std::string dispFile;
             iss >> dispFile;
-            std::shared_ptr<QImage> dispMap = std::make_shared<QImage>(QString::fromStdString(basePath + dispFile));
-            if (dispMap && !dispMap->isNull()) {
-                currentMtl.displacementMap = dispMap;
-                currentMtl.hasDisplacementMap = true;
-            }
+            textures.push_back({currentMtlName, &Material::displacementMap, &Material::hasDisplacementMap, basePath + dispFile});
         }
     }
 
     if (!currentMtlName.empty()) {
         materials[currentMtlName] = currentMtl;
     }
+
+    std::vector<std::shared_ptr<const QImage>> images(textures.size());
+    PGK_JobSystem::instance().parallelFor(textures.size(), 1, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            images[i] = PGK_AssetManager::instance().getTexture(textures[i].path);
+        }
+    });
+    for (size_t i = 0; i < textures.size(); ++i) {
+        const auto material = materials.find(textures[i].material);
+        if (!images[i] || textures[i].material.empty() || material == materials.end())
+            continue;
+        material->second.*textures[i].texture = images[i];
+        material->second.*textures[i].hasTexture = true;
+    }
 }
@@ -1,6 +1,7 @@
 #ifndef PGK_OBJ_H
 #define PGK_OBJ_H
 
+#include "pgk_bvh.h"
 #include "pgk_math.h"
 
 #include <QImage>
@@ -27,12 +28,29 @@ struct Material
     bool hasDisplacementMap = false;
     bool hasTexture = false;
     float normalMapStrength = 1.0f;
-    std::shared_ptr<QImage> texture;
-    std::shared_ptr<QImage> normalMap;
-    std::shared_ptr<QImage> specularMap;
-    std::shared_ptr<QImage> specularHighlightMap;
-    std::shared_ptr<QImage> alphaMap;
-    std::shared_ptr<QImage> displacementMap;
+    std::shared_ptr<const QImage> texture;
+    std::shared_ptr<const QImage> normalMap;
+    std::shared_ptr<const QImage> specularMap;
+    std::shared_ptr<const QImage> specularHighlightMap;
+    std::shared_ptr<const QImage> alphaMap;
+    std::shared_ptr<const QImage> displacementMap;
+};
+
+// neighbouring triangles that are culled together, object space
+struct MeshCluster
+{
+    uint32_t firstIndex; // its triangles are indices [firstIndex, firstIndex + indexCount)
+    uint32_t indexCount;
+    uint32_t firstVertex; // its distinct vertices are clusterVertices [firstVertex, firstVertex + vertexCount)
+    uint32_t vertexCount;
+    Vec3 boundsMin;
+    Vec3 boundsMax;
+    Vec3 center;
+    float radius;
+    // every triangle normal is within the cone, coneCutoff is the sine of its half angle and
+    // above 1 when the triangles can't all face away at once
+    Vec3 coneAxis;
+    float coneCutoff;
 };
 
 struct Mesh
@@ -41,6 +59,27 @@ struct Mesh
     std::vector<unsigned int> indices;
     Material material;
     std::string name;
+    std::shared_ptr<const PGK_BVH> bvh; // object space, for raycasts over bvhTriangles
+    // object space, one tangent and bitangent per triangle for normal mapping
+    std::vector<Vec3> tangents;
+    std::vector<Vec3> bitangents;
+    // object space box and sphere around the vertices
+    Vec3 boundsMin;
+    Vec3 boundsMax;
+    Vec3 boundsCenter;
+    float boundsRadius = 0;
+    std::vector<MeshCluster> clusters;
+    std::vector<unsigned int> clusterVertices;
+    // simplified versions, each with at most half the triangles of the one before. they only hold
+    // geometry and are drawn with the material of this mesh
+    std::vector<Mesh> lods;
+    float lodError = 0; // of a level, how far its surface is at most from the full mesh, object space
+
+    // the triangles as the bvh reads them, straight from vertices and indices
+    PGK_BVH::Triangles bvhTriangles() const
+    {
+        return PGK_BVH::Triangles{vertices.empty() ? nullptr : &vertices[0].position, sizeof(Vertex), indices.data(), indices.size() / 3};
+    }
 };
 
 struct Triangle{
@@ -63,6 +102,13 @@ inline bool operator==(const Triangle &t1, const Triangle &t2){
 namespace ObjLoader
 {
     std::vector<Mesh> loadObj(const std::string& filename);
+    // reorders the triangles, so it runs before buildTangents and buildBVH
+    void buildClusters(Mesh& mesh);
+    void buildBVH(Mesh& mesh);
+    // the levels of detail, each with its own bounds, clusters and tangents
+    void buildLods(Mesh& mesh);
+    void buildTangents(Mesh& mesh);
+    void computeBounds(Mesh& mesh);
     void parseMtlFile(const std::string& filename, std::map<std::string, Material>& materials, const std::string& basePath);
 };
 
@@ -0,0 +1,233 @@
+#include "pgk_occlusion.h"
+
+#include "pgk_jobsystem.h"
+
+#include <cmath>
+#include <limits>
+
+// occluder triangles per job while they are projected
+static constexpr size_t SETUP_GRAIN = 256;
+
+void PGK_OcclusionBuffer::render(const Mat4 &viewProjection, float nearClip, const std::vector<Vec3> &occluderVertices, int screenWidth, int screenHeight)
+{
+    this->viewProjection = viewProjection;
+    this->nearClip = nearClip;
+
+    // the pyramid halves down to a single texel
+    int width = std::max(1, (screenWidth + TEXEL_SIZE - 1) / TEXEL_SIZE);
+    int height = std::max(1, (screenHeight + TEXEL_SIZE - 1) / TEXEL_SIZE);
+    size_t levelCount = 0;
+    while (true)
+    {
+        if (levels.size() <= levelCount)
+            levels.emplace_back();
+        Level &level = levels[levelCount++];
+        level.width = width;
+        level.height = height;
+        level.depth.resize(width * height);
+        if (width == 1 && height == 1)
+            break;
+        width = (width + 1) / 2;
+        height = (height + 1) / 2;
+    }
+    levels.resize(levelCount);
+
+    setupTriangles(occluderVertices);
+
+    // every band owns its rows, so they can be rasterized in any order
+    PGK_JobSystem::instance().parallelFor(bands.size(), 1, [&](size_t begin, size_t end)
+                                          {
+        for (size_t i = begin; i < end; ++i) {
+            rasterizeBand(i);
+        } });
+
+    buildPyramid();
+}
+
+bool PGK_OcclusionBuffer::isOccluded(const Vec3 &boundsMin, const Vec3 &boundsMax) const
+{
+    if (levels.empty())
+        return false;
+
+    const Level &finest = levels[0];
+    float minX = std::numeric_limits<float>::max(), minY = minX, nearest = minX;
+    float maxX = std::numeric_limits<float>::lowest(), maxY = maxX;
+    for (int i = 0; i < 8; ++i)
+    {
+        const Vec3 corner(i & 1 ? boundsMax.x : boundsMin.x, i & 2 ? boundsMax.y : boundsMin.y, i & 4 ? boundsMax.z : boundsMin.z);
+        const Vec4 clip = viewProjection * Vec4(corner);
+        if (clip.w < nearClip)
+            return false; // reaches past the camera
+        const float x = (clip.x / clip.w + 1) * 0.5f * finest.width;
+        const float y = (1 - clip.y / clip.w) * 0.5f * finest.height;
+        minX = std::min(minX, x);
+        maxX = std::max(maxX, x);
+        minY = std::min(minY, y);
+        maxY = std::max(maxY, y);
+        nearest = std::min(nearest, clip.w);
+    }
+
+    // a texel counts as covered once its center is, one texel of margin keeps the box from
+    // hiding in the uncovered part of an edge texel
+    const int x0 = std::max(0, static_cast<int>(std::floor(minX)) - 1);
+    const int x1 = std::min(finest.width - 1, static_cast<int>(std::floor(maxX)) + 1);
+    const int y0 = std::max(0, static_cast<int>(std::floor(minY)) - 1);
+    const int y1 = std::min(finest.height - 1, static_cast<int>(std::floor(maxY)) + 1);
+    if (x0 > x1 || y0 > y1)
+        return false; // off screen, that is up to the frustum
+
+    // the level where the rect spans a few texels, each holds the farthest occluder below it
+    size_t level = 0;
+    while (level + 1 < levels.size() && std::max(x1 - x0, y1 - y0) >> level >= 4)
+    {
+        level++;
+    }
+    const Level &coarse = levels[level];
+    for (int y = y0 >> level; y <= y1 >> level; ++y)
+    {
+        for (int x = x0 >> level; x <= x1 >> level; ++x)
+        {
+            if (coarse.depth[y * coarse.width + x] >= nearest)
+                return false;
+        }
+    }
+    return true;
+}
+
+void PGK_OcclusionBuffer::setupTriangles(const std::vector<Vec3> &occluderVertices)
+{
+    const Level &finest = levels[0];
+    const size_t count = occluderVertices.size() / 3;
+    triangles.resize(count * 2);
+    triangleUsed.assign(count * 2, 0);
+
+    const auto toTexel = [&](const Vec4 &clip)
+    {
+        return Vec3((clip.x / clip.w + 1) * 0.5f * finest.width, (1 - clip.y / clip.w) * 0.5f * finest.height, 1.0f / clip.w);
+    };
+    PGK_JobSystem::instance().parallelFor(count, SETUP_GRAIN, [&](size_t begin, size_t end)
+                                          {
+        for (size_t i = begin; i < end; ++i) {
+            const Vec4 v[3] = {viewProjection * Vec4(occluderVertices[i * 3]), viewProjection * Vec4(occluderVertices[i * 3 + 1]),
+                               viewProjection * Vec4(occluderVertices[i * 3 + 2])};
+
+            // clip against the near plane, one plane turns a triangle into at most a quad
+            Vec4 polygon[4];
+            int vertexCount = 0;
+            for (int e = 0; e < 3; ++e) {
+                const Vec4 &a = v[e];
+                const Vec4 &b = v[(e + 1) % 3];
+                const bool aInside = a.w >= nearClip;
+                const bool bInside = b.w >= nearClip;
+                if (aInside)
+                    polygon[vertexCount++] = a;
+                if (aInside != bInside)
+                    polygon[vertexCount++] = a + (b - a) * ((nearClip - a.w) / (b.w - a.w));
+            }
+
+            for (int k = 0; k + 2 < vertexCount; ++k) {
+                const ScreenTriangle triangle = {toTexel(polygon[0]), toTexel(polygon[k + 1]), toTexel(polygon[k + 2])};
+                const Vec3 &a = triangle.p0, &b = triangle.p1, &c = triangle.p2;
+                if (PGK_Math::edgeFunction(a, b, c) <= 0)
+                    continue; // back face
+                if (std::max({a.x, b.x, c.x}) < 0 || std::min({a.x, b.x, c.x}) >= finest.width
+                    || std::max({a.y, b.y, c.y}) < 0 || std::min({a.y, b.y, c.y}) >= finest.height)
+                    continue; // off the buffer
+                triangles[i * 2 + k] = triangle;
+                triangleUsed[i * 2 + k] = 1;
+            }
+        } });
+
+    const size_t bandCount = (finest.height + BAND_HEIGHT - 1) / BAND_HEIGHT;
+    bands.resize(bandCount);
+    for (auto &band : bands)
+    {
+        band.clear();
+    }
+    for (uint32_t i = 0; i < triangles.size(); ++i)
+    {
+        if (!triangleUsed[i])
+            continue;
+        const ScreenTriangle &triangle = triangles[i];
+        const float minY = std::min({triangle.p0.y, triangle.p1.y, triangle.p2.y});
+        const float maxY = std::max({triangle.p0.y, triangle.p1.y, triangle.p2.y});
+        const int firstBand = std::max(0, static_cast<int>(minY)) / BAND_HEIGHT;
+        const int lastBand = std::min(static_cast<int>(maxY), finest.height - 1) / BAND_HEIGHT;
+        for (int band = firstBand; band <= lastBand; ++band)
+        {
+            bands[band].push_back(i);
+        }
+    }
+}
+
+void PGK_OcclusionBuffer::rasterizeBand(size_t band)
+{
+    Level &finest = levels[0];
+    const int width = finest.width;
+    const int bandMinY = band * BAND_HEIGHT;
+    const int bandMaxY = std::min(bandMinY + BAND_HEIGHT, finest.height) - 1;
+    std::fill(finest.depth.begin() + bandMinY * width, finest.depth.begin() + (bandMaxY + 1) * width, std::numeric_limits<float>::max());
+
+    for (const uint32_t index : bands[band])
+    {
+        const ScreenTriangle &triangle = triangles[index];
+        const Vec3 &a = triangle.p0;
+        const Vec3 &b = triangle.p1;
+        const Vec3 &c = triangle.p2;
+        const float invArea = 1.0f / PGK_Math::edgeFunction(a, b, c);
+
+        const int minX = std::max(0, static_cast<int>(std::min({a.x, b.x, c.x})));
+        const int maxX = std::min(width - 1, static_cast<int>(std::max({a.x, b.x, c.x})));
+        const int minY = std::max(bandMinY, static_cast<int>(std::min({a.y, b.y, c.y})));
+        const int maxY = std::min(bandMaxY, static_cast<int>(std::max({a.y, b.y, c.y})));
+
+        // texels are covered by their center, but take the farthest depth of the triangle within
+        // them. 1/w is linear in screen space, so that is half a texel of slope in x and y away
+        const float w0dx = c.y - b.y, w1dx = a.y - c.y, w2dx = b.y - a.y;
+        const float w0dy = b.x - c.x, w1dy = c.x - a.x, w2dy = a.x - b.x;
+        const float zdx = (w0dx * a.z + w1dx * b.z + w2dx * c.z) * invArea;
+        const float zdy = (w0dy * a.z + w1dy * b.z + w2dy * c.z) * invArea;
+        const float farOffset = 0.5f * (std::abs(zdx) + std::abs(zdy));
+        const float farthest = std::min({a.z, b.z, c.z});
+        for (int y = minY; y <= maxY; ++y)
+        {
+            const Vec3 p(minX + 0.5f, y + 0.5f, 0);
+            float w0 = PGK_Math::edgeFunction(b, c, p);
+            float w1 = PGK_Math::edgeFunction(c, a, p);
+            float w2 = PGK_Math::edgeFunction(a, b, p);
+            float z = (w0 * a.z + w1 * b.z + w2 * c.z) * invArea;
+
+            float *depthRow = &finest.depth[y * width];
+            for (int x = minX; x <= maxX; ++x, w0 += w0dx, w1 += w1dx, w2 += w2dx, z += zdx)
+            {
+                if (w0 < 0 || w1 < 0 || w2 < 0)
+                    continue;
+                const float depth = 1.0f / std::max(z - farOffset, farthest);
+                if (depth < depthRow[x])
+                    depthRow[x] = depth;
+            }
+        }
+    }
+}
+
+void PGK_OcclusionBuffer::buildPyramid()
+{
+    for (size_t l = 1; l < levels.size(); ++l)
+    {
+        const Level &fine = levels[l - 1];
+        Level &coarse = levels[l];
+        PGK_JobSystem::instance().parallelFor(coarse.height, BAND_HEIGHT, [&](size_t begin, size_t end)
+                                              {
+            for (size_t y = begin; y < end; ++y) {
+                // an odd row or column at the edge has no partner
+                const int y0 = y * 2;
+                const int y1 = std::min(y0 + 1, fine.height - 1);
+                for (int x = 0; x < coarse.width; ++x) {
+                    const int x0 = x * 2;
+                    const int x1 = std::min(x0 + 1, fine.width - 1);
+                    coarse.depth[y * coarse.width + x] = std::max({fine.depth[y0 * fine.width + x0], fine.depth[y0 * fine.width + x1],
+                                                                   fine.depth[y1 * fine.width + x0], fine.depth[y1 * fine.width + x1]});
+                }
+            } });
+    }
+}
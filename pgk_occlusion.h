@@ -0,0 +1,52 @@
+#ifndef PGK_OCCLUSION_H
+#define PGK_OCCLUSION_H
+
+#include "pgk_math.h"
+
+#include <vector>
+
+// coarse depth of the occluders seen from the camera and a pyramid of its farthest depths. boxes
+// that are behind it everywhere they cover can skip the vertex stage
+class PGK_OcclusionBuffer
+{
+public:
+    // occluderVertices holds three world space positions per occluding triangle, only their front
+    // faces occlude like only those are drawn. the buffer is TEXEL_SIZE times coarser than the screen
+    void render(const Mat4 &viewProjection, float nearClip, const std::vector<Vec3> &occluderVertices, int screenWidth, int screenHeight);
+
+    // true when every part of the world space box that is on screen is behind the occluders
+    bool isOccluded(const Vec3 &boundsMin, const Vec3 &boundsMax) const;
+
+private:
+    static constexpr int TEXEL_SIZE = 4; // screen pixels per texel side
+    static constexpr int BAND_HEIGHT = 8;
+
+    // occluder triangle in texel coordinates, z is 1/w
+    struct ScreenTriangle
+    {
+        Vec3 p0, p1, p2;
+    };
+
+    // levels[0] holds the view depth w of the nearest occluder per texel, every level after it
+    // the farthest of the 2x2 texels below
+    struct Level
+    {
+        int width;
+        int height;
+        std::vector<float> depth;
+    };
+
+    void setupTriangles(const std::vector<Vec3> &occluderVertices);
+    void rasterizeBand(size_t band);
+    void buildPyramid();
+
+    Mat4 viewProjection;
+    float nearClip = 0;
+    // a triangle clipped by the near plane leaves at most two, slot 2i + 1 is only used then
+    std::vector<ScreenTriangle> triangles;
+    std::vector<char> triangleUsed;
+    std::vector<std::vector<uint32_t>> bands;
+    std::vector<Level> levels;
+};
+
+#endif // PGK_OCCLUSION_H
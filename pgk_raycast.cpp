@@ -1,43 +1,143 @@
 #include "pgk_raycast.h"
 #include "pgk_gameobject.h"
+#include "pgk_jobsystem.h"
 
-RaycastHit PGK_Raycast::raycast(const Vec3 &orig, const Vec3 &dir, const float &length, const std::vector<std::shared_ptr<PGK_GameObject> > &gameObjects)
+// packets per job when a batch is split over the job system
+static constexpr size_t BATCH_GRAIN = 16;
+
+// the direction keeps its length, so t along the object space ray is the world distance
+static void toObjectSpace(const Mat4 &worldTransform, const Vec3 &orig, const Vec3 &dir, Vec3 &objectOrig, Vec3 &objectDir)
+{
+    const Mat4 inverse = worldTransform.inverse();
+    objectOrig = inverse * orig;
+    objectDir = Vec3(inverse * Vec4(dir.x, dir.y, dir.z, 0));
+}
+
+void PGK_Raycast::resolveHit(RaycastHit &hit, const Mesh &mesh, const PGK_BVH::Hit &meshHit, const Mat4 &worldTransform, const Vec3 &orig, const Vec3 &dir, const Vec3 &objectOrig, const Vec3 &objectDir)
+{
+    const Vec3 v0 = mesh.vertices[mesh.indices[meshHit.triangle * 3]].position;
+    const Vec3 v1 = mesh.vertices[mesh.indices[meshHit.triangle * 3 + 1]].position;
+    const Vec3 v2 = mesh.vertices[mesh.indices[meshHit.triangle * 3 + 2]].position;
+    const Vec3 e1 = v1 - v0;
+    const Vec3 e2 = v2 - v0;
+
+    // barycentric of the hit point, u and v like Moller-Trumbore
+    const Vec3 p = objectDir.cross(e2);
+    const float invDet = 1.0f / e1.dot(p);
+    const Vec3 t = objectOrig - v0;
+    const float u = t.dot(p) * invDet;
+    const float v = objectDir.dot(t.cross(e1)) * invDet;
+
+    hit.hit = true;
+    hit.distance = meshHit.t;
+    hit.point = orig + dir * meshHit.t;
+    hit.normal = Vec3(PGK_Math::normalMatrix(worldTransform) * Vec4(e1.cross(e2))).normalize();
+    hit.barycentric = Vec3(1 - u - v, u, v);
+}
+
+RaycastHit PGK_Raycast::raycast(const Vec3 &orig, const Vec3 &dir, const float &length, const std::vector<std::shared_ptr<PGK_GameObject> > &gameObjects, const PGK_GameObject *ignore)
 {
     RaycastHit hit;
     hit.distance = length;
     for (const auto& gameObject : gameObjects) {
-        for (const auto& mesh : gameObject->getMeshes()) {
-            for (size_t i = 0; i < mesh.indices.size(); i += 3) {
-                const Vec3 v0 = mesh.vertices[mesh.indices[i]].position;
-                const Vec3 v1 = mesh.vertices[mesh.indices[i + 1]].position;
-                const Vec3 v2 = mesh.vertices[mesh.indices[i + 2]].position;
-
-                const Vec3 e1 = v1 - v0;
-                const Vec3 e2 = v2 - v0;
-                const Vec3 p = dir.cross(e2);
-                const float det = e1.dot(p);
-
-                if (det > -EPS && det < EPS) continue;
-
-                const float invDet = 1.0f / det;
-                const Vec3 t = orig - v0;
-                const float u = t.dot(p) * invDet;
-                if (u < 0 || u > 1) continue;
-
-                const Vec3 q = t.cross(e1);
-                const float v = dir.dot(q) * invDet;
-                if (v < 0 || u + v > 1) continue;
-
-                const float distance = e2.dot(q) * invDet;
-                if (distance < hit.distance && distance < length) {
-                    hit.hit = true;
-                    hit.distance = distance;
-                    hit.point = orig + dir * distance;
-                    hit.normal = e1.cross(e2).normalize();
-                    hit.barycentric = Vec3(1 - u - v, u, v);
-                }
+        if (gameObject.get() == ignore)
+            continue;
+
+        for (size_t instance = 0; instance < gameObject->getInstanceCount(); ++instance) {
+            const Mat4 worldTransform = gameObject->getInstanceWorldTransform(instance);
+            Vec3 objectOrig, objectDir;
+            toObjectSpace(worldTransform, orig, dir, objectOrig, objectDir);
+
+            for (const auto& mesh : gameObject->getMeshes()) {
+                PGK_BVH::Hit meshHit;
+                if (!mesh.bvh || !mesh.bvh->closestHit(mesh.bvhTriangles(), objectOrig, objectDir, hit.distance, meshHit))
+                    continue;
+                resolveHit(hit, mesh, meshHit, worldTransform, orig, dir, objectOrig, objectDir);
             }
         }
     }
     return hit;
 }
+
+bool PGK_Raycast::raycastAny(const Vec3 &orig, const Vec3 &dir, const float &length, const std::vector<std::shared_ptr<PGK_GameObject> > &gameObjects, const PGK_GameObject *ignore)
+{
+    for (const auto& gameObject : gameObjects) {
+        if (gameObject.get() == ignore)
+            continue;
+
+        for (size_t instance = 0; instance < gameObject->getInstanceCount(); ++instance) {
+            Vec3 objectOrig, objectDir;
+            toObjectSpace(gameObject->getInstanceWorldTransform(instance), orig, dir, objectOrig, objectDir);
+
+            for (const auto& mesh : gameObject->getMeshes()) {
+                if (mesh.bvh && mesh.bvh->anyHit(mesh.bvhTriangles(), objectOrig, objectDir, length))
+                    return true;
+            }
+        }
+    }
+    return false;
+}
+
+std::vector<RaycastHit> PGK_Raycast::raycastBatch(const std::vector<RaycastQuery> &queries, const std::vector<std::shared_ptr<PGK_GameObject> > &gameObjects, const PGK_GameObject *ignore)
+{
+    std::vector<RaycastHit> hits(queries.size());
+    for (size_t i = 0; i < queries.size(); ++i) {
+        hits[i].distance = queries[i].length;
+    }
+
+    // world transforms and their inverses once for the whole batch instead of once per ray,
+    // an instanced object is listed once per instance
+    std::vector<const PGK_GameObject *> objects;
+    std::vector<Mat4> worldTransforms;
+    std::vector<Mat4> inverseTransforms;
+    for (const auto& gameObject : gameObjects) {
+        if (gameObject.get() == ignore)
+            continue;
+        for (size_t instance = 0; instance < gameObject->getInstanceCount(); ++instance) {
+            objects.push_back(gameObject.get());
+            worldTransforms.push_back(gameObject->getInstanceWorldTransform(instance));
+            inverseTransforms.push_back(worldTransforms.back().inverse());
+        }
+    }
+
+    constexpr int PACKET_SIZE = PGK_BVH::PACKET_SIZE;
+    const size_t packetCount = (queries.size() + PACKET_SIZE - 1) / PACKET_SIZE;
+    PGK_JobSystem::instance().parallelFor(packetCount, BATCH_GRAIN, [&](size_t begin, size_t end)
+    {
+        Vec3 objectOrigins[PACKET_SIZE];
+        Vec3 objectDirections[PACKET_SIZE];
+        float maxT[PACKET_SIZE];
+        PGK_BVH::Hit meshHits[PACKET_SIZE];
+
+        for (size_t packet = begin; packet < end; ++packet) {
+            const size_t first = packet * PACKET_SIZE;
+            const int count = static_cast<int>(std::min<size_t>(PACKET_SIZE, queries.size() - first));
+
+            for (size_t o = 0; o < objects.size(); ++o) {
+                const Mat4 &inverse = inverseTransforms[o];
+                for (int i = 0; i < count; ++i) {
+                    const RaycastQuery &query = queries[first + i];
+                    objectOrigins[i] = inverse * query.origin;
+                    objectDirections[i] = Vec3(inverse * Vec4(query.direction.x, query.direction.y, query.direction.z, 0));
+                }
+
+                for (const auto& mesh : objects[o]->getMeshes()) {
+                    if (!mesh.bvh)
+                        continue;
+                    for (int i = 0; i < count; ++i) {
+                        maxT[i] = hits[first + i].distance;
+                    }
+
+                    const int hitMask = mesh.bvh->closestHitPacket(mesh.bvhTriangles(), objectOrigins, objectDirections, maxT, count, meshHits);
+                    for (int i = 0; i < count; ++i) {
+                        if (!(hitMask & (1 << i)))
+                            continue;
+                        const RaycastQuery &query = queries[first + i];
+                        resolveHit(hits[first + i], mesh, meshHits[i], worldTransforms[o], query.origin, query.direction, objectOrigins[i], objectDirections[i]);
+                    }
+                }
+            }
+        }
+    });
+    return hits;
+}
@@ -2,6 +2,7 @@
 #define PGK_RAYCAST_H
 
 #include "pgk_math.h"
+#include "pgk_obj.h"
 
 #include <memory>
 #include <vector>
@@ -15,11 +16,23 @@ struct RaycastHit {
     float distance;
 };
 
+struct RaycastQuery {
+    Vec3 origin;
+    Vec3 direction;
+    float length;
+};
+
 class PGK_Raycast {
 public:
-    static RaycastHit raycast(const Vec3 &orig, const Vec3 &dir, const float &length, const std::vector<std::shared_ptr<PGK_GameObject>> &gameObjects);
+    // closest hit along dir within length, meshes are tested in their object's world transform
+    static RaycastHit raycast(const Vec3 &orig, const Vec3 &dir, const float &length, const std::vector<std::shared_ptr<PGK_GameObject>> &gameObjects, const PGK_GameObject *ignore = nullptr);
+    // true as soon as anything is hit, cheaper than raycast when only occlusion matters
+    static bool raycastAny(const Vec3 &orig, const Vec3 &dir, const float &length, const std::vector<std::shared_ptr<PGK_GameObject>> &gameObjects, const PGK_GameObject *ignore = nullptr);
+    // closest hit for every query, results line up with queries. rays are traced in SIMD packets
+    // and large batches are split over the job system, so neighbouring queries should be coherent
+    static std::vector<RaycastHit> raycastBatch(const std::vector<RaycastQuery> &queries, const std::vector<std::shared_ptr<PGK_GameObject>> &gameObjects, const PGK_GameObject *ignore = nullptr);
 private:
-    
+    static void resolveHit(RaycastHit &hit, const Mesh &mesh, const PGK_BVH::Hit &meshHit, const Mat4 &worldTransform, const Vec3 &orig, const Vec3 &dir, const Vec3 &objectOrig, const Vec3 &objectDir);
 };
 
 #endif // PGK_RAYCAST_H
@@ -1,6 +1,8 @@
 #include "pgk_scene.h"
+#include "pgk_assets.h"
 #include "pgk_draw.h"
 #include "pgk_input.h"
+#include "pgk_jobsystem.h"
 #include "pgk_light.h"
 #include "pgk_raycast.h"
 
@@ -8,14 +10,76 @@
 #include <QJsonArray>
 #include <QJsonDocument>
 #include <QJsonObject>
+#include <limits>
 #include <thread>
 
+// triangles per binning job, see binTriangles
+static constexpr size_t BIN_CHUNK_SIZE = 4096;
+
+// the canonical path of a scene file's asset path, empty stays empty
+static std::string assetPath(const QString &path)
+{
+    if (path.isEmpty())
+        return std::string();
+    return PGK_AssetManager::canonicalPath(QDir::currentPath().toStdString() + "/" + path.toStdString());
+}
+
+// objects up to this many triangles become occluders once their bounding sphere's radius is
+// AUTO_OCCLUDER_MIN_SIZE of half the screen height, the AUTO_OCCLUDER_COUNT largest of them.
+// larger ones only when the scene marks them with "occluder"
+static constexpr uint64_t AUTO_OCCLUDER_MAX_TRIANGLES = 2048;
+static constexpr float AUTO_OCCLUDER_MIN_SIZE = 0.25f;
+static constexpr size_t AUTO_OCCLUDER_COUNT = 8;
+
+// stands in for meshes that are still loading, a unit cube
+static PGK_AssetManager::MeshHandle placeholderMeshes()
+{
+    static const PGK_AssetManager::MeshHandle placeholder = []()
+    {
+        // normal and two edge directions of every face, counter clockwise seen from outside
+        const Vec3 faces[6][3] = {
+            {Vec3(1, 0, 0), Vec3(0, 1, 0), Vec3(0, 0, 1)},
+            {Vec3(-1, 0, 0), Vec3(0, 0, 1), Vec3(0, 1, 0)},
+            {Vec3(0, 1, 0), Vec3(0, 0, 1), Vec3(1, 0, 0)},
+            {Vec3(0, -1, 0), Vec3(1, 0, 0), Vec3(0, 0, 1)},
+            {Vec3(0, 0, 1), Vec3(1, 0, 0), Vec3(0, 1, 0)},
+            {Vec3(0, 0, -1), Vec3(0, 1, 0), Vec3(1, 0, 0)}};
+        const Vec2 corners[4] = {Vec2(-1, -1), Vec2(1, -1), Vec2(1, 1), Vec2(-1, 1)};
+
+        Mesh cube;
+        cube.name = "placeholder";
+        for (const auto &face : faces)
+        {
+            const unsigned int first = cube.vertices.size();
+            for (const Vec2 &corner : corners)
+            {
+                Vertex vertex;
+                vertex.position = (face[0] + face[1] * corner.x + face[2] * corner.y) * 0.5f;
+                vertex.normal = face[0];
+                vertex.texCoord = Vec2((corner.x + 1) * 0.5f, (corner.y + 1) * 0.5f);
+                cube.vertices.push_back(vertex);
+            }
+            for (const unsigned int index : {0, 1, 2, 0, 2, 3})
+            {
+                cube.indices.push_back(first + index);
+            }
+        }
+        ObjLoader::computeBounds(cube);
+        ObjLoader::buildClusters(cube);
+        ObjLoader::buildTangents(cube);
+        ObjLoader::buildBVH(cube);
+        return std::make_shared<const std::vector<Mesh>>(1, cube);
+    }();
+    return placeholder;
+}
+
 PGK_Scene::PGK_Scene()
 {
     createDefaultScene();
 }
 
-PGK_Scene::PGK_Scene(QString scenePath)
+PGK_Scene::PGK_Scene(QString scenePath, LoadProgressCallback onLoadProgress)
+    : onLoadProgress(std::move(onLoadProgress))
 {
     this->camera = std::make_shared<PGK_Camera>();
     this->camera->setAspectRatio(g_pgkCore.ASPECT_RATIO);
@@ -43,7 +107,9 @@ PGK_Scene::PGK_Scene(QString scenePath)
         QJsonArray background = sceneObject.value("background").toArray();
         this->sceneBackgroundColor = std::make_shared<cVec3>(background[0].toInt(), background[1].toInt(), background[2].toInt());
 
+        // assets load on the workers while the objects are set up with placeholders
         QJsonArray objectsArray = sceneObject.value("objects").toArray();
+        loadAssets(objectsArray);
         for (const QJsonValue &objectValue : objectsArray)
         {
             QJsonObject object = objectValue.toObject();
@@ -60,6 +126,11 @@ PGK_Scene::PGK_Scene(QString scenePath)
         QJsonObject cameraObject = sceneObject.value("camera").toObject();
         parseCamera(cameraObject);
 
+        if (g_pgkCore.STREAM_ASSETS)
+            attachLoadedMeshes();
+        else
+            finishLoading();
+
         sceneFile.close();
     }
     else
@@ -71,10 +142,28 @@ PGK_Scene::PGK_Scene(QString scenePath)
     triangleBufferSize = rootObject->calcTriangleBufferSize();
 }
 
-PGK_Scene::~PGK_Scene() {}
+PGK_Scene::~PGK_Scene()
+{
+    // the load tasks write into this scene. the ones that haven't started return right away, so
+    // this only waits for the loads under way
+    cancelLoading = true;
+    PGK_JobSystem::instance().wait(loadCounter, PGK_JobSystem::Priority::Background);
+}
+
+bool PGK_Scene::isLoading() const
+{
+    return loading;
+}
+
+PGK_Scene::LoadProgress PGK_Scene::getLoadProgress() const
+{
+    return LoadProgress{loadedTasks, loadGraph.getTaskCount()};
+}
 
 void PGK_Scene::update(float &deltaTime)
 {
+    if (loading)
+        attachLoadedMeshes();
     camera->updateCamera(deltaTime);
     rootObject->update(deltaTime);
     for (const auto &light : lights)
@@ -90,31 +179,378 @@ void PGK_Scene::render(PGK_View *view)
     triangleBuffer.clear();
     triangleBuffer.reserve(triangleBufferSize);
 
-    rootObject->getTriangleBuffer(triangleBuffer, view, this->camera->getViewMatrix(), this->camera->getProjectionMatrix(view->nearClip, view->farClip));
-    if(g_pgkCore.AVAILABLE_THREADS < 2)
+    // world transforms are cached lazily, resolve them here before the jobs below read them
+    rootObject->updateWorldTransforms();
+    camera->updateWorldTransforms();
+    for (const auto &light : lights)
+    {
+        light->updateWorldTransforms();
+    }
+
+    // vertex stage, one job per top level object; buffers are joined in scene order
+    const Mat4 viewMatrix = this->camera->getViewMatrix();
+    const Mat4 projectionMatrix = this->camera->getProjectionMatrix(view->nearClip, view->farClip);
+    const Frustum frustum = this->camera->getFrustum(view->nearClip, view->farClip);
+    const std::vector<std::shared_ptr<PGK_GameObject>> objects = rootObject->getChildren();
+    objectTriangleBuffers.resize(objects.size());
+    // objects behind the occluders skip the vertex stage
+    const bool occlusionCulling = g_pgkCore.OCCLUSION_CULLING;
+    objectTested.assign(objects.size(), 0);
+    objectOccluded.assign(objects.size(), 0);
+    occlusionStats = OcclusionStats();
+    if (occlusionCulling)
+        renderOcclusion(view, objects, viewMatrix, projectionMatrix, frustum);
+    PGK_JobSystem::instance().parallelFor(objects.size(), 1, [&](size_t begin, size_t end)
+                                          {
+        for (size_t i = begin; i < end; ++i) {
+            objectTriangleBuffers[i].clear();
+            const PGK_GameObject::Bounds &bounds = objects[i]->getSubtreeBounds();
+            if (occlusionCulling && bounds.intersects(frustum)) {
+                objectTested[i] = 1;
+                objectOccluded[i] = occlusionBuffer.isOccluded(bounds.min, bounds.max);
+            }
+            if (!objectOccluded[i])
+                objects[i]->getTriangleBuffer(objectTriangleBuffers[i], view, viewMatrix, projectionMatrix, frustum, occlusionCulling ? &occlusionBuffer : nullptr);
+        } });
+    for (const auto &buffer : objectTriangleBuffers)
+    {
+        std::copy(buffer.begin(), buffer.end(), std::back_inserter(triangleBuffer));
+    }
+    for (size_t i = 0; i < objects.size(); ++i)
+    {
+        occlusionStats.tested += objectTested[i];
+        occlusionStats.culled += objectOccluded[i];
+    }
+    if (g_pgkCore.SHADOW_MAPS)
+        renderShadowMaps();
+    else if (g_pgkCore.RAYCAST_SHADOWS)
+        updateShadowBVH();
+    binTriangles(view);
+
+    lightConstants.clear();
+    for (const auto &light : lights)
     {
-        for (const auto &triangle : triangleBuffer)
+        lightConstants.push_back(light->getConstants());
+    }
+    cullLights(view, projectionMatrix * viewMatrix);
+
+    // every tile is owned by exactly one worker, so z-test and canvas writes never race
+    // and the result doesn't depend on the thread count
+    const ShadingContext context{triangleBuffer, lightConstants, camera->getWorldPosition(), shadowBVH, shadowCasterTriangles()};
+    PGK_JobSystem::instance().parallelFor(view->tiles.size(), 1, [&](size_t begin, size_t end)
+                                          {
+        for (size_t i = begin; i < end; ++i) {
+            drawTile(view, view->tiles[i], context);
+        } });
+}
+
+PGK_Scene::CasterChange PGK_Scene::updateShadowCasters(bool coarse)
+{
+    // one entry per mesh and instance, so comparing them is cheap next to the vertices
+    nextShadowCasters.clear();
+    rootObject->getShadowCasters(nextShadowCasters, coarse);
+    CasterChange change = nextShadowCasters.size() == shadowCasters.size() ? CasterChange::None : CasterChange::Replaced;
+    for (size_t i = 0; i < nextShadowCasters.size() && change != CasterChange::Replaced; ++i)
+    {
+        if (nextShadowCasters[i].mesh != shadowCasters[i].mesh)
+            change = CasterChange::Replaced;
+        else if (nextShadowCasters[i].worldTransform != shadowCasters[i].worldTransform)
+            change = CasterChange::Moved;
+    }
+    if (change == CasterChange::None)
+        return change;
+    std::swap(shadowCasters, nextShadowCasters);
+
+    if (change == CasterChange::Replaced)
+    {
+        casterVertexOffsets.resize(shadowCasters.size());
+        casterIndexOffsets.resize(shadowCasters.size());
+        size_t vertexCount = 0;
+        size_t indexCount = 0;
+        for (size_t i = 0; i < shadowCasters.size(); ++i)
         {
-            PGK_Draw::drawTriangle(view->canvas, triangle, view->_zbuffer, lights, camera->getWorldPosition(), triangleBuffer);
+            casterVertexOffsets[i] = vertexCount;
+            casterIndexOffsets[i] = indexCount;
+            vertexCount += shadowCasters[i].mesh->vertices.size();
+            indexCount += shadowCasters[i].mesh->indices.size();
         }
-        return;
+        shadowCasterPositions.resize(vertexCount);
+        shadowCasterIndices.resize(indexCount);
+    }
+
+    // the indices only move with the offsets, so moving casters only transforms their vertices
+    PGK_JobSystem::instance().parallelFor(shadowCasters.size(), 1, [&](size_t begin, size_t end)
+                                          {
+        for (size_t i = begin; i < end; ++i) {
+            const Mesh &mesh = *shadowCasters[i].mesh;
+            const Mat4 &worldTransform = shadowCasters[i].worldTransform;
+            Vec3 *positions = &shadowCasterPositions[casterVertexOffsets[i]];
+            for (const Vertex &vertex : mesh.vertices) {
+                *positions++ = worldTransform * vertex.position;
+            }
+            if (change == CasterChange::Replaced) {
+                uint32_t *indices = &shadowCasterIndices[casterIndexOffsets[i]];
+                for (const unsigned int index : mesh.indices) {
+                    *indices++ = static_cast<uint32_t>(casterVertexOffsets[i] + index);
+                }
+            }
+        } });
+    return change;
+}
+
+PGK_BVH::Triangles PGK_Scene::shadowCasterTriangles() const
+{
+    return PGK_BVH::Triangles{shadowCasterPositions.data(), sizeof(Vec3), shadowCasterIndices.data(), shadowCasterIndices.size() / 3};
+}
+
+void PGK_Scene::updateShadowBVH()
+{
+    // full meshes, a coarser caster would shadow the surface it was simplified from. the tree
+    // depends on the casters alone, not on what the camera sees
+    switch (updateShadowCasters(false))
+    {
+    case CasterChange::Replaced:
+        shadowBVH.build(shadowCasterTriangles());
+        break;
+    case CasterChange::Moved:
+        // refit, or rebuild once the moved casters left the tree too loose
+        shadowBVH.update(shadowCasterTriangles());
+        break;
+    case CasterChange::None:
+        break;
+    }
+}
+
+void PGK_Scene::renderShadowMaps()
+{
+    updateShadowCasters(true);
+
+    for (const auto &light : lights)
+    {
+        if (!light->castShadows)
+            continue;
+        if (!light->shadowMap)
+            light->shadowMap = std::make_shared<PGK_ShadowMap>();
+        light->shadowMap->render(*light, shadowCasterPositions, shadowCasterIndices, g_pgkCore.SHADOW_MAP_SIZE);
+    }
+}
+
+void PGK_Scene::renderOcclusion(PGK_View *view, const std::vector<std::shared_ptr<PGK_GameObject>> &objects, const Mat4 &viewMatrix, const Mat4 &projectionMatrix, const Frustum &frustum)
+{
+    // the occluders are the objects the scene marks and the largest small ones on screen, size
+    // being the bounding sphere relative to the screen height
+    const Vec3 cameraPosition = camera->getWorldPosition();
+    std::vector<PGK_GameObject *> occluders;
+    std::vector<std::pair<float, PGK_GameObject *>> candidates;
+    for (const auto &object : objects)
+    {
+        const PGK_GameObject::Bounds &bounds = object->getSubtreeBounds();
+        if (!bounds.intersects(frustum))
+            continue;
+        if (object->isOccluder)
+        {
+            occluders.push_back(object.get());
+            continue;
+        }
+        if (object->calcTriangleBufferSize() / 3 > AUTO_OCCLUDER_MAX_TRIANGLES)
+            continue;
+        const float distance = std::max(bounds.center.distance(cameraPosition), view->nearClip);
+        const float size = bounds.radius * projectionMatrix.m11 / distance;
+        if (size >= AUTO_OCCLUDER_MIN_SIZE)
+            candidates.emplace_back(size, object.get());
+    }
+    const size_t autoCount = std::min(candidates.size(), AUTO_OCCLUDER_COUNT);
+    std::partial_sort(candidates.begin(), candidates.begin() + autoCount, candidates.end(), [](const auto &a, const auto &b)
+                      { return a.first > b.first; });
+    for (size_t i = 0; i < autoCount; ++i)
+    {
+        occluders.push_back(candidates[i].second);
+    }
+    occlusionStats.occluders = occluders.size();
+
+    objectOccluderVertices.resize(occluders.size());
+    PGK_JobSystem::instance().parallelFor(occluders.size(), 1, [&](size_t begin, size_t end)
+                                          {
+        for (size_t i = begin; i < end; ++i) {
+            objectOccluderVertices[i].clear();
+            occluders[i]->getOccluderVertices(objectOccluderVertices[i]);
+        } });
+    occluderVertices.clear();
+    for (size_t i = 0; i < occluders.size(); ++i)
+    {
+        occluderVertices.insert(occluderVertices.end(), objectOccluderVertices[i].begin(), objectOccluderVertices[i].end());
     }
-    std::vector<std::thread> threads;
-    size_t numThreads = g_pgkCore.AVAILABLE_THREADS;
-    size_t chunkSize = triangleBuffer.size() / numThreads;
-    for (size_t i = 0; i < numThreads; ++i)
-    {
-        threads.emplace_back([&, i]()
-                             {
-        size_t start = i * chunkSize;
-        size_t end = (i == numThreads - 1) ? triangleBuffer.size() : start + chunkSize;
-        for (size_t j = start; j < end; ++j) {
-            PGK_Draw::drawTriangle(view->canvas, triangleBuffer[j], view->_zbuffer, lights, camera->getWorldPosition(), triangleBuffer);
+    occlusionBuffer.render(projectionMatrix * viewMatrix, view->nearClip, occluderVertices, view->resWidth, view->resHeight);
+}
+
+void PGK_Scene::binTriangles(PGK_View *view)
+{
+    // every job bins a fixed run of the triangle buffer into lists of its own, the tiles then join
+    // them in buffer order. the result is the same for any thread count
+    const int tileSize = view->tileSize;
+    const size_t chunkCount = (triangleBuffer.size() + BIN_CHUNK_SIZE - 1) / BIN_CHUNK_SIZE;
+    if (chunkBins.size() < chunkCount)
+        chunkBins.resize(chunkCount);
+    PGK_JobSystem::instance().parallelFor(chunkCount, 1, [&](size_t begin, size_t end)
+                                          {
+        for (size_t chunk = begin; chunk < end; ++chunk) {
+            std::vector<std::vector<uint32_t>> &bins = chunkBins[chunk];
+            bins.resize(view->tiles.size());
+            for (auto &bin : bins) {
+                bin.clear();
+            }
+
+            const size_t last = std::min(triangleBuffer.size(), (chunk + 1) * BIN_CHUNK_SIZE);
+            for (size_t i = chunk * BIN_CHUNK_SIZE; i < last; ++i) {
+                const Triangle &triangle = triangleBuffer[i];
+                if (PGK_Math::edgeFunction(triangle.s0, triangle.s1, triangle.s2) <= 0)
+                    continue; // backface
+
+                const int minX = static_cast<int>(std::min({triangle.s0.x, triangle.s1.x, triangle.s2.x}));
+                const int maxX = static_cast<int>(std::max({triangle.s0.x, triangle.s1.x, triangle.s2.x}));
+                const int minY = static_cast<int>(std::min({triangle.s0.y, triangle.s1.y, triangle.s2.y}));
+                const int maxY = static_cast<int>(std::max({triangle.s0.y, triangle.s1.y, triangle.s2.y}));
+                if (maxX < 0 || maxY < 0 || minX >= view->resWidth || minY >= view->resHeight)
+                    continue; // offscreen
+
+                const int tileMinX = std::max(minX, 0) / tileSize;
+                const int tileMaxX = std::min(maxX, view->resWidth - 1) / tileSize;
+                const int tileMinY = std::max(minY, 0) / tileSize;
+                const int tileMaxY = std::min(maxY, view->resHeight - 1) / tileSize;
+
+                for (int ty = tileMinY; ty <= tileMaxY; ++ty) {
+                    for (int tx = tileMinX; tx <= tileMaxX; ++tx) {
+                        const Tile &tile = view->tiles[tx + ty * view->tilesX];
+                        if (!PGK_Draw::isRectOutsideTriangle(triangle, tile.minX, tile.minY, tile.maxX, tile.maxY))
+                            bins[tx + ty * view->tilesX].push_back(i);
+                    }
+                }
+            }
         } });
+
+    const float clearDepth = std::numeric_limits<float>::lowest();
+    PGK_JobSystem::instance().parallelFor(view->tiles.size(), 1, [&](size_t begin, size_t end)
+                                          {
+        for (size_t t = begin; t < end; ++t) {
+            Tile &tile = view->tiles[t];
+            tile.triangles.clear();
+            tile.minDepth = clearDepth;
+            std::fill(tile.depthBlocks.begin(), tile.depthBlocks.end(), DepthBlock{clearDepth, clearDepth});
+            for (size_t chunk = 0; chunk < chunkCount; ++chunk) {
+                tile.triangles.insert(tile.triangles.end(), chunkBins[chunk][t].begin(), chunkBins[chunk][t].end());
+            }
+        } });
+}
+
+// pixel rect the sphere can cover, false if it's entirely offscreen
+static bool sphereScreenRect(const Vec3 &center, float radius, const Mat4 &viewProjection, const PGK_View *view, int &minX, int &minY, int &maxX, int &maxY)
+{
+    minX = 0;
+    minY = 0;
+    maxX = view->resWidth - 1;
+    maxY = view->resHeight - 1;
+    if (radius < 0)
+        return true;
+
+    // the projected corners of the sphere's box bound everything inside it, as long as
+    // none of them is behind the near plane
+    float left = std::numeric_limits<float>::max(), top = left;
+    float right = std::numeric_limits<float>::lowest(), bottom = right;
+    for (int i = 0; i < 8; ++i)
+    {
+        const Vec3 corner = center + Vec3(i & 1 ? radius : -radius, i & 2 ? radius : -radius, i & 4 ? radius : -radius);
+        const Vec4 clipped = viewProjection * Vec4(corner);
+        if (clipped.w < view->nearClip)
+            return true;
+        const Vec2 screen = PGK_Math::projectionToScreen(PGK_Math::clipToNDC(clipped), view->resWidth, view->resHeight);
+        left = std::min(left, screen.x);
+        right = std::max(right, screen.x);
+        top = std::min(top, screen.y);
+        bottom = std::max(bottom, screen.y);
+    }
+    if (right < 0 || bottom < 0 || left >= view->resWidth || top >= view->resHeight)
+        return false;
+    minX = std::max(minX, static_cast<int>(left));
+    minY = std::max(minY, static_cast<int>(top));
+    maxX = std::min(maxX, static_cast<int>(right));
+    maxY = std::min(maxY, static_cast<int>(bottom));
+    return true;
+}
+
+// a sphere around everything the light reaches, a spot light only reaches the part of its range
+// within the cone
+static void lightBounds(const LightConstants &light, Vec3 &center, float &radius)
+{
+    center = light.position;
+    radius = light.range;
+    if (light.type != PGK_Light::Type::Spot || light.range < 0 || light.cosOuter <= 0)
+        return;
+
+    // the smallest sphere through the apex and the rim of the cone's cap, wide cones are
+    // bounded by the rim alone
+    const float sinOuter = std::sqrt(std::max(0.0f, 1.0f - light.cosOuter * light.cosOuter));
+    if (light.cosOuter >= sinOuter)
+    {
+        radius = light.range / (2.0f * light.cosOuter);
+        center = light.position + light.direction * radius;
     }
-    for (auto &thread : threads)
+    else
     {
-        thread.join();
+        radius = light.range * sinOuter;
+        center = light.position + light.direction * (light.range * light.cosOuter);
+    }
+}
+
+void PGK_Scene::cullLights(PGK_View *view, const Mat4 &viewProjection)
+{
+    for (auto &tile : view->tiles)
+    {
+        tile.lights.clear();
+    }
+
+    // a tile only shades with the lights whose range, and cone for spot lights, overlaps it on screen
+    const int tileSize = view->tileSize;
+    for (uint32_t i = 0; i < lightConstants.size(); ++i)
+    {
+        Vec3 center;
+        float radius;
+        lightBounds(lightConstants[i], center, radius);
+        int minX, minY, maxX, maxY;
+        if (!sphereScreenRect(center, radius, viewProjection, view, minX, minY, maxX, maxY))
+            continue;
+
+        for (int ty = minY / tileSize; ty <= maxY / tileSize; ++ty)
+        {
+            for (int tx = minX / tileSize; tx <= maxX / tileSize; ++tx)
+            {
+                view->tiles[tx + ty * view->tilesX].lights.push_back(i);
+            }
+        }
+    }
+}
+
+void PGK_Scene::drawTile(PGK_View *view, Tile &tile, const ShadingContext &context)
+{
+    if (g_pgkCore.DEFERRED_SHADING)
+    {
+        // visibility pass first, then light every covered pixel exactly once regardless of overdraw
+        for (int y = tile.minY; y <= tile.maxY; ++y)
+        {
+            const auto row = view->_visibilityBuffer.begin() + y * view->resWidth;
+            std::fill(row + tile.minX, row + tile.maxX + 1, VisibilitySample{VisibilitySample::NO_TRIANGLE, 0.f, 0.f});
+        }
+        for (const uint32_t index : tile.triangles)
+        {
+            PGK_Draw::drawTriangleVisibility(triangleBuffer[index], index, tile, view->_zbuffer, view->_visibilityBuffer, view->resWidth);
+        }
+        PGK_Draw::shadeVisibilityTile(view->canvas, tile, view->_visibilityBuffer, context);
+        return;
+    }
+
+    // triangles stay in submission order, same as a single threaded draw
+    for (const uint32_t index : tile.triangles)
+    {
+        PGK_Draw::drawTriangle(view->canvas, triangleBuffer[index], tile, view->_zbuffer, context);
     }
 }
 
@@ -191,6 +627,7 @@ void PGK_Scene::createDefaultScene()
 
 void PGK_Scene::parseGameObject(const QJsonObject &object)
 {
+    // "type" is accepted and ignored, a StaticObject caches and draws like any other object
     // QString type = object.value("type").toString();
     QString name = object.value("name").toString();
     QString meshPath = object.value("mesh").toString();
@@ -202,35 +639,30 @@ void PGK_Scene::parseGameObject(const QJsonObject &object)
 
     if (object.contains("mesh"))
     {
-        std::vector<Mesh> meshes = ObjLoader::loadObj(QDir::currentPath().toStdString() + "/" + meshPath.toStdString());
-        if (object.contains("texture")) //texture overwrite
+        // a placeholder until loadAssets delivers the meshes, objects using the same files
+        // share one copy of them
+        const MeshRequest key{assetPath(meshPath), assetPath(texturePath)};
+        const auto request = std::find_if(meshRequests.begin(), meshRequests.end(), [&](const MeshRequest &request)
+                                          { return request.meshPath == key.meshPath && request.texturePath == key.texturePath; });
+        if (request != meshRequests.end())
         {
-            auto texture = std::make_shared<QImage>(QImage(texturePath));
-            for (auto &mesh : meshes)
-            {
-                mesh.material.texture = texture;
-                mesh.material.hasTexture = true;
-            }
+            gameObject->setMeshes(placeholderMeshes());
+            waitingObjects.emplace_back(gameObject, request - meshRequests.begin());
         }
-        gameObject->setMeshes(meshes);
     }
     else
     {
         gameObject->isVisible = false;
     }
 
-    if (object.contains("type"))
-    {
-        if (object.value("type").toString() == "StaticObject")
-            gameObject->isStatic = true;
-    }
-
     gameObject->setName(name);
 
     if (castShadows)
         gameObject->castShadows = true;
     if (receiveShadows)
         gameObject->receiveShadows = true;
+    if (object.value("occluder").toBool())
+        gameObject->isOccluder = true;
 
     if (object.contains("position"))
     {
@@ -251,6 +683,37 @@ void PGK_Scene::parseGameObject(const QJsonObject &object)
         gameObject->setLocalScale(scale);
     }
 
+    if (object.contains("instances"))
+    {
+        // one transform per copy, relative to the object; the meshes are shared by all of them
+        std::vector<Mat4> instances;
+        QJsonArray instancesArray = object.value("instances").toArray();
+        for (const QJsonValue &instanceValue : instancesArray)
+        {
+            QJsonObject instance = instanceValue.toObject();
+            Vec3 position(0, 0, 0);
+            Vec3 rotation(0, 0, 0);
+            Vec3 scale(1, 1, 1);
+            if (instance.contains("position"))
+            {
+                QJsonArray positionArray = instance.value("position").toArray();
+                position = Vec3(positionArray[0].toDouble(), positionArray[1].toDouble(), positionArray[2].toDouble());
+            }
+            if (instance.contains("rotation"))
+            {
+                QJsonArray rotationArray = instance.value("rotation").toArray();
+                rotation = Vec3(rotationArray[0].toDouble(), rotationArray[1].toDouble(), rotationArray[2].toDouble());
+            }
+            if (instance.contains("scale"))
+            {
+                QJsonArray scaleArray = instance.value("scale").toArray();
+                scale = Vec3(scaleArray[0].toDouble(), scaleArray[1].toDouble(), scaleArray[2].toDouble());
+            }
+            instances.push_back(Mat4::Transform(position, Quat(rotation, Quat::RotationOrder::XYZ), scale));
+        }
+        gameObject->setInstances(instances);
+    }
+
     if (object.contains("components"))
     {
         QJsonArray componentsArray = object.value("components").toArray();
@@ -290,6 +753,134 @@ void PGK_Scene::parseGameObject(const QJsonObject &object)
     }
 }
 
+void PGK_Scene::loadAssets(const QJsonArray &objects)
+{
+    // one task per distinct mesh file and texture override, and one per mesh/texture pair that
+    // waits for its two inputs and marks the pair ready. files are told apart by canonical path, so two spellings of one file load
+    // once. the results stay referenced here until every object holds them
+    std::vector<std::string> meshPaths;
+    std::vector<std::string> texturePaths;
+    for (const QJsonValue &objectValue : objects)
+    {
+        const QJsonObject object = objectValue.toObject();
+        MeshRequest request{assetPath(object.value("mesh").toString()), assetPath(object.value("texture").toString())};
+        if (request.meshPath.empty())
+            continue;
+        request.meshIndex = std::find(meshPaths.begin(), meshPaths.end(), request.meshPath) - meshPaths.begin();
+        if (request.meshIndex == meshPaths.size())
+            meshPaths.push_back(request.meshPath);
+        if (!request.texturePath.empty())
+        {
+            request.textureIndex = std::find(texturePaths.begin(), texturePaths.end(), request.texturePath) - texturePaths.begin();
+            if (request.textureIndex == texturePaths.size())
+                texturePaths.push_back(request.texturePath);
+        }
+        if (std::find_if(meshRequests.begin(), meshRequests.end(), [&](const MeshRequest &other)
+                         { return other.meshPath == request.meshPath && other.texturePath == request.texturePath; }) == meshRequests.end())
+            meshRequests.push_back(request);
+    }
+
+    baseMeshes.resize(meshPaths.size());
+    overrideTextures.resize(texturePaths.size());
+
+    std::vector<PGK_TaskGraph::TaskId> meshTasks;
+    for (size_t i = 0; i < meshPaths.size(); ++i)
+    {
+        meshTasks.push_back(loadGraph.addTask([this, i, path = meshPaths[i]]()
+                                              {
+            if (cancelLoading)
+                return;
+            baseMeshes[i] = PGK_AssetManager::instance().getMeshes(path);
+            loadedTasks++; }));
+    }
+    std::vector<PGK_TaskGraph::TaskId> textureTasks;
+    for (size_t i = 0; i < texturePaths.size(); ++i)
+    {
+        textureTasks.push_back(loadGraph.addTask([this, i, path = texturePaths[i]]()
+                                                 {
+            if (cancelLoading)
+                return;
+            overrideTextures[i] = PGK_AssetManager::instance().getTexture(path);
+            loadedTasks++; }));
+    }
+    for (size_t r = 0; r < meshRequests.size(); ++r)
+    {
+        const MeshRequest &request = meshRequests[r];
+        const PGK_TaskGraph::TaskId task = loadGraph.addTask([this, r]()
+                                                             {
+            {
+                std::lock_guard<std::mutex> lock(readyMutex);
+                readyRequests.push_back(r);
+            }
+            loadedTasks++; });
+        loadGraph.addDependency(meshTasks[request.meshIndex], task);
+        if (!request.texturePath.empty())
+            loadGraph.addDependency(textureTasks[request.textureIndex], task);
+    }
+
+    // in the background, so a frame's waits never pick up a load while streaming
+    loading = true;
+    loadGraph.start(loadCounter, PGK_JobSystem::Priority::Background);
+}
+
+void PGK_Scene::finishLoading()
+{
+    // the constructing thread helps with the loading and reports the progress in between
+    size_t reported = 0;
+    bool done = false;
+    while (!done)
+    {
+        done = loadCounter.pending == 0;
+        if (!done && !PGK_JobSystem::instance().runPendingTask(PGK_JobSystem::Priority::Background))
+            std::this_thread::yield();
+        if (onLoadProgress && loadedTasks != reported)
+        {
+            reported = loadedTasks;
+            onLoadProgress(reported, loadGraph.getTaskCount());
+        }
+    }
+    attachLoadedMeshes();
+}
+
+void PGK_Scene::attachLoadedMeshes()
+{
+    // read before taking the finished requests, so a finished graph has delivered all of them
+    const bool done = loadCounter.pending == 0;
+    std::vector<size_t> ready;
+    {
+        std::lock_guard<std::mutex> lock(readyMutex);
+        ready.swap(readyRequests);
+    }
+
+    if (!ready.empty())
+    {
+        for (auto &waiting : waitingObjects)
+        {
+            if (std::find(ready.begin(), ready.end(), waiting.second) == ready.end())
+                continue;
+            // the override goes on the object, so objects with and without one share the meshes
+            const MeshRequest &request = meshRequests[waiting.second];
+            waiting.first->setMeshes(baseMeshes[request.meshIndex]);
+            if (!request.texturePath.empty())
+                waiting.first->setTexture(overrideTextures[request.textureIndex]);
+        }
+        waitingObjects.erase(std::remove_if(waitingObjects.begin(), waitingObjects.end(), [&](const auto &waiting)
+                                            { return std::find(ready.begin(), ready.end(), waiting.second) != ready.end(); }),
+                             waitingObjects.end());
+        triangleBufferSize = rootObject->calcTriangleBufferSize();
+    }
+
+    if (!done)
+        return;
+    loading = false;
+    baseMeshes.clear();
+    overrideTextures.clear();
+
+    const PGK_AssetManager::Footprint footprint = PGK_AssetManager::instance().getFootprint();
+    qDebug() << "Assets:" << footprint.meshCount << "mesh files," << footprint.meshBytes / 1024 << "KiB,"
+             << footprint.textureCount << "textures," << footprint.textureBytes / 1024 << "KiB";
+}
+
 void PGK_Scene::parseComponent(std::shared_ptr<PGK_GameObject> gameObject, const QJsonObject &component)
 {
     QString type = component.value("type").toString();
@@ -433,7 +1024,7 @@ void PGK_Scene::parseComponent(std::shared_ptr<PGK_GameObject> gameObject, const
             Vec3 rayDirection = Vec3(0, -1, 0);
             float rayLength = 20.0f;
 
-            RaycastHit hit = PGK_Raycast::raycast(rayOrigin, rayDirection, rayLength, this->rootObject->getChildren());
+            RaycastHit hit = PGK_Raycast::raycast(rayOrigin, rayDirection, rayLength, this->rootObject->getChildren(), self);
             if (hit.hit)
             {
                 position.y = hit.point.y + 1.1f;
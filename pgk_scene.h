@@ -1,19 +1,47 @@
 #ifndef PGK_SCENE_H
 #define PGK_SCENE_H
 
+#include "pgk_assets.h"
+#include "pgk_bvh.h"
 #include "pgk_camera.h"
+#include "pgk_draw.h"
 #include "pgk_gameobject.h"
+#include "pgk_occlusion.h"
 #include "pgk_view.h"
 #include <pgk_core.h>
+#include <atomic>
+#include <functional>
 #include <memory>
+#include <mutex>
 
 class PGK_Scene {
 public:
+    // finished and total load tasks, see loadAssets
+    typedef std::function<void(size_t loaded, size_t total)> LoadProgressCallback;
+    struct LoadProgress
+    {
+        size_t loaded;
+        size_t total;
+    };
+    // of the last frame, top level objects on screen that were tested against the occluders
+    struct OcclusionStats
+    {
+        size_t occluders = 0;
+        size_t tested = 0;
+        size_t culled = 0;
+    };
+
     PGK_Scene();
-    PGK_Scene(QString scenePath);
+    // onLoadProgress is called on the constructing thread while it waits for the assets. with
+    // g_pgkCore.STREAM_ASSETS the constructor doesn't wait, objects show placeholders until
+    // update() hands them their meshes
+    PGK_Scene(QString scenePath, LoadProgressCallback onLoadProgress = nullptr);
     ~PGK_Scene();
 
     std::shared_ptr<PGK_Camera> getCamera() { return camera; }
+    bool isLoading() const;
+    LoadProgress getLoadProgress() const;
+    OcclusionStats getOcclusionStats() const { return occlusionStats; }
 
     void update(float &deltaTime);
     void render(PGK_View *view);
@@ -21,18 +49,81 @@ public:
 private:
     std::shared_ptr<PGK_GameObject> rootObject;
     std::vector<Triangle> triangleBuffer;
+    std::vector<std::vector<Triangle>> objectTriangleBuffers;
+    // per binning job and tile, the triangles it found in the tile
+    std::vector<std::vector<std::vector<uint32_t>>> chunkBins;
+    // the meshes casting shadows and their world space vertices, three indices into
+    // shadowCasterPositions per triangle. every caster fills its range from its offsets on
+    std::vector<PGK_GameObject::ShadowCaster> shadowCasters;
+    std::vector<PGK_GameObject::ShadowCaster> nextShadowCasters;
+    std::vector<size_t> casterVertexOffsets;
+    std::vector<size_t> casterIndexOffsets;
+    std::vector<Vec3> shadowCasterPositions;
+    std::vector<uint32_t> shadowCasterIndices;
+    PGK_OcclusionBuffer occlusionBuffer;
+    std::vector<Vec3> occluderVertices;
+    std::vector<std::vector<Vec3>> objectOccluderVertices;
+    // per top level object, whether it was on screen and tested and whether it was hidden
+    std::vector<char> objectTested;
+    std::vector<char> objectOccluded;
+    OcclusionStats occlusionStats;
+    PGK_BVH shadowBVH; // over the casters for raycast shadows
     std::vector<std::shared_ptr<PGK_Light> > lights;
+    std::vector<LightConstants> lightConstants;
     std::shared_ptr<PGK_Camera> camera;
     std::shared_ptr<cVec3> sceneBackgroundColor;
     void createDefaultScene();
+    // how the casters differ from the last frame's
+    enum class CasterChange
+    {
+        None,
+        Moved,   // the same meshes, some of them somewhere else
+        Replaced // other meshes
+    };
+    // only transforms the vertices again when something changed, see PGK_GameObject::getShadowCasters for coarse
+    CasterChange updateShadowCasters(bool coarse);
+    PGK_BVH::Triangles shadowCasterTriangles() const;
+    void renderShadowMaps();
+    void renderOcclusion(PGK_View *view, const std::vector<std::shared_ptr<PGK_GameObject>> &objects, const Mat4 &viewMatrix, const Mat4 &projectionMatrix, const Frustum &frustum);
+    void updateShadowBVH();
+    void binTriangles(PGK_View *view);
+    void cullLights(PGK_View *view, const Mat4 &viewProjection);
+    void drawTile(PGK_View *view, Tile &tile, const ShadingContext &context);
 
     //Json scene parser
+    void loadAssets(const QJsonArray& objects);
+    void finishLoading();
+    void attachLoadedMeshes();
     void parseGameObject(const QJsonObject& object);
     void parseComponent(std::shared_ptr<PGK_GameObject> gameObject, const QJsonObject& component);
     void parseLight(const QJsonObject& light);
     void parseCamera(const QJsonObject& camera);
     std::shared_ptr<PGK_GameObject> findObjectByName(const QString& name);
 
+    // the meshes of an object by canonical paths, texturePath is empty without a texture override.
+    // the indices are its entries in baseMeshes and overrideTextures
+    struct MeshRequest
+    {
+        std::string meshPath;
+        std::string texturePath;
+        size_t meshIndex = 0;
+        size_t textureIndex = 0;
+    };
+    std::vector<MeshRequest> meshRequests;
+    // written by the load tasks, readyRequests lists the requests whose mesh and texture are done
+    std::vector<PGK_AssetManager::MeshHandle> baseMeshes;
+    std::vector<PGK_AssetManager::TextureHandle> overrideTextures;
+    std::mutex readyMutex;
+    std::vector<size_t> readyRequests;
+    // objects showing a placeholder and the request they wait for
+    std::vector<std::pair<std::shared_ptr<PGK_GameObject>, size_t>> waitingObjects;
+    PGK_TaskGraph loadGraph;
+    PGK_JobSystem::Counter loadCounter;
+    std::atomic<size_t> loadedTasks = 0;
+    std::atomic<bool> cancelLoading = false; // set by the destructor, load tasks that haven't started skip their load
+    bool loading = false;
+    LoadProgressCallback onLoadProgress;
+
     uint64_t triangleBufferSize=0;
 };
 
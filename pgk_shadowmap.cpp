@@ -0,0 +1,317 @@
+#include "pgk_shadowmap.h"
+
+#include "pgk_core.h"
+#include "pgk_jobsystem.h"
+#include "pgk_light.h"
+
+#include <array>
+#include <limits>
+
+// any up vector works as long as it isn't parallel to the view direction
+static Vec3 upVectorFor(const Vec3 &direction)
+{
+    return std::abs(direction.y) > 0.99f ? Vec3(0, 0, 1) : Vec3(0, 1, 0);
+}
+
+void PGK_ShadowMap::render(const PGK_Light &light, const std::vector<Vec3> &casterPositions, const std::vector<uint32_t> &casterIndices, uint32_t resolution)
+{
+    this->resolution = resolution;
+    setupFaces(light, casterPositions);
+
+    // one face after the other, each spread over all workers
+    for (auto &face : faces)
+    {
+        setupTriangles(face, casterPositions, casterIndices);
+    }
+
+    // every band of every face owns its rows, so they can be rasterized in any order
+    const size_t bandCount = (resolution + BAND_HEIGHT - 1) / BAND_HEIGHT;
+    PGK_JobSystem::instance().parallelFor(faces.size() * bandCount, 1, [&](size_t begin, size_t end)
+                                          {
+        for (size_t i = begin; i < end; ++i) {
+            rasterizeBand(faces[i / bandCount], i % bandCount);
+        } });
+}
+
+float PGK_ShadowMap::getLitFraction(const Vec3 &surfacePos, const Vec3 &normal) const
+{
+    if (faces.empty())
+        return 1.0f;
+
+    const Face &face = selectFace(surfacePos);
+
+    // world size of a texel at the surface, used to push the lookup off the surface against acne
+    float texelSize = 2.0f / (face.scale * resolution);
+    if (perspective)
+        texelSize *= std::max(-(face.view * surfacePos).z, NEAR_CLIP);
+
+    float x, y, depth;
+    if (!project(face, face.view * (surfacePos + normal * (texelSize * 1.5f)), x, y, depth))
+        return 1.0f; // behind the light
+    const float receiverDepth = depth - texelSize;
+
+    const int radius = std::max(0, g_pgkCore.SHADOW_PCF_RADIUS);
+    const int centerX = static_cast<int>(std::floor(x));
+    const int centerY = static_cast<int>(std::floor(y));
+    const int size = static_cast<int>(resolution);
+    int lit = 0;
+    for (int ty = centerY - radius; ty <= centerY + radius; ++ty)
+    {
+        for (int tx = centerX - radius; tx <= centerX + radius; ++tx)
+        {
+            // nothing was rendered outside the map
+            if (tx < 0 || ty < 0 || tx >= size || ty >= size || receiverDepth <= face.depth[ty * size + tx])
+                lit++;
+        }
+    }
+    return static_cast<float>(lit) / ((2 * radius + 1) * (2 * radius + 1));
+}
+
+void PGK_ShadowMap::setupFaces(const PGK_Light &light, const std::vector<Vec3> &casterPositions)
+{
+    lightPosition = light.getWorldPosition();
+
+    switch (light.lightType)
+    {
+    case PGK_Light::Type::Spot:
+    {
+        perspective = true;
+        cube = false;
+        const Vec3 direction = light.getWorldRotation() * Vec3(0, 0, -1);
+        faces.resize(1);
+        faces[0].view = PGK_Math::lookAtMatrix(lightPosition, lightPosition + direction, upVectorFor(direction));
+        faces[0].scale = 1.0f / std::tan(std::min(light.angle, 1.45f)); // the cone is light.angle wide on each side
+        faces[0].offsetX = faces[0].offsetY = 0;
+        break;
+    }
+    case PGK_Light::Type::Point:
+    {
+        // +X, -X, +Y, -Y, +Z, -Z, see selectFace
+        static const std::array<Vec3, 6> axes = {Vec3(1, 0, 0), Vec3(-1, 0, 0), Vec3(0, 1, 0), Vec3(0, -1, 0), Vec3(0, 0, 1), Vec3(0, 0, -1)};
+        perspective = true;
+        cube = true;
+        faces.resize(6);
+        for (size_t i = 0; i < faces.size(); ++i)
+        {
+            faces[i].view = PGK_Math::lookAtMatrix(lightPosition, lightPosition + axes[i], upVectorFor(axes[i]));
+            faces[i].scale = 1.0f; // 90 degree field of view
+            faces[i].offsetX = faces[i].offsetY = 0;
+        }
+        break;
+    }
+    case PGK_Light::Type::Directional:
+    {
+        // directional lights are shaded towards their position, so the map looks from there at the origin
+        perspective = false;
+        cube = false;
+        Vec3 direction = -lightPosition;
+        if (direction.lengthSq() < 1e-6f)
+            direction = Vec3(0, -1, 0);
+        direction.normalize();
+        faces.resize(1);
+        Face &face = faces[0];
+        face.view = PGK_Math::lookAtMatrix(lightPosition, lightPosition + direction, upVectorFor(direction));
+
+        // fit the map around the casters
+        float minX = std::numeric_limits<float>::max();
+        float minY = std::numeric_limits<float>::max();
+        float maxX = std::numeric_limits<float>::lowest();
+        float maxY = std::numeric_limits<float>::lowest();
+        for (const Vec3 &vertex : casterPositions)
+        {
+            const Vec3 viewPos = face.view * vertex;
+            minX = std::min(minX, viewPos.x);
+            minY = std::min(minY, viewPos.y);
+            maxX = std::max(maxX, viewPos.x);
+            maxY = std::max(maxY, viewPos.y);
+        }
+        if (casterPositions.empty())
+            minX = minY = maxX = maxY = 0;
+        const float halfExtent = std::max({maxX - minX, maxY - minY, 0.01f}) * 0.5f * 1.01f;
+        face.scale = 1.0f / halfExtent;
+        face.offsetX = (minX + maxX) * 0.5f;
+        face.offsetY = (minY + maxY) * 0.5f;
+        break;
+    }
+    }
+
+    for (auto &face : faces)
+    {
+        face.depth.resize(resolution * resolution);
+    }
+}
+
+void PGK_ShadowMap::setupTriangles(Face &face, const std::vector<Vec3> &casterPositions, const std::vector<uint32_t> &casterIndices)
+{
+    // every vertex moves into the view once, however many triangles share it
+    viewPositions.resize(casterPositions.size());
+    PGK_JobSystem::instance().parallelFor(casterPositions.size(), SETUP_CHUNK_SIZE, [&](size_t begin, size_t end)
+                                          {
+        for (size_t i = begin; i < end; ++i) {
+            viewPositions[i] = face.view * casterPositions[i];
+        } });
+
+    const size_t triangleCount = casterIndices.size() / 3;
+    const size_t chunkCount = (triangleCount + SETUP_CHUNK_SIZE - 1) / SETUP_CHUNK_SIZE;
+    const size_t bandCount = (resolution + BAND_HEIGHT - 1) / BAND_HEIGHT;
+    face.chunks.resize(chunkCount);
+
+    const auto toTexel = [&](const Vec3 &viewPos)
+    {
+        float x, y, depth;
+        project(face, viewPos, x, y, depth);
+        return Vec3(x, y, perspective ? 1.0f / std::max(depth, NEAR_CLIP) : depth);
+    };
+    PGK_JobSystem::instance().parallelFor(chunkCount, 1, [&](size_t begin, size_t end)
+                                          {
+        for (size_t chunkIndex = begin; chunkIndex < end; ++chunkIndex) {
+            SetupChunk &chunk = face.chunks[chunkIndex];
+            chunk.triangles.clear();
+            chunk.bands.resize(bandCount);
+            for (auto &band : chunk.bands) {
+                band.clear();
+            }
+
+            const auto addTriangle = [&](const Vec3 &p0, const Vec3 &p1, const Vec3 &p2) {
+                const float minY = std::min({p0.y, p1.y, p2.y});
+                const float maxY = std::max({p0.y, p1.y, p2.y});
+                if (std::max({p0.x, p1.x, p2.x}) < 0 || std::min({p0.x, p1.x, p2.x}) >= resolution || maxY < 0 || minY >= resolution)
+                    return; // off the map
+
+                const uint32_t index = chunk.triangles.size();
+                chunk.triangles.push_back(MapTriangle{p0, p1, p2});
+                const int firstBand = std::max(0, static_cast<int>(minY)) / BAND_HEIGHT;
+                const int lastBand = std::min(static_cast<int>(maxY), static_cast<int>(resolution) - 1) / BAND_HEIGHT;
+                for (int band = firstBand; band <= lastBand; ++band) {
+                    chunk.bands[band].push_back(index);
+                }
+            };
+
+            const size_t last = std::min(triangleCount, (chunkIndex + 1) * SETUP_CHUNK_SIZE);
+            for (size_t i = chunkIndex * SETUP_CHUNK_SIZE; i < last; ++i) {
+                const std::array<Vec3, 3> v = {viewPositions[casterIndices[i * 3]], viewPositions[casterIndices[i * 3 + 1]],
+                                               viewPositions[casterIndices[i * 3 + 2]]};
+                if (!perspective) {
+                    addTriangle(toTexel(v[0]), toTexel(v[1]), toTexel(v[2]));
+                    continue;
+                }
+
+                // clip against the near plane, one plane turns a triangle into at most a quad
+                std::array<Vec3, 4> polygon;
+                int count = 0;
+                for (int e = 0; e < 3; ++e) {
+                    const Vec3 &a = v[e];
+                    const Vec3 &b = v[(e + 1) % 3];
+                    const bool aInside = -a.z >= NEAR_CLIP;
+                    const bool bInside = -b.z >= NEAR_CLIP;
+                    if (aInside)
+                        polygon[count++] = a;
+                    if (aInside != bInside)
+                        polygon[count++] = a + (b - a) * ((-NEAR_CLIP - a.z) / (b.z - a.z));
+                }
+                if (count < 3)
+                    continue;
+
+                const Vec3 p0 = toTexel(polygon[0]);
+                Vec3 p1 = toTexel(polygon[1]);
+                for (int k = 2; k < count; ++k) {
+                    const Vec3 p2 = toTexel(polygon[k]);
+                    addTriangle(p0, p1, p2);
+                    p1 = p2;
+                }
+            }
+        } });
+}
+
+void PGK_ShadowMap::rasterizeBand(Face &face, size_t band) const
+{
+    const int size = static_cast<int>(resolution);
+    const int bandMinY = band * BAND_HEIGHT;
+    const int bandMaxY = std::min(bandMinY + BAND_HEIGHT, size) - 1;
+    std::fill(face.depth.begin() + bandMinY * size, face.depth.begin() + (bandMaxY + 1) * size, std::numeric_limits<float>::max());
+
+    for (const SetupChunk &chunk : face.chunks)
+    {
+        for (const uint32_t index : chunk.bands[band])
+        {
+            // casters are drawn from both sides
+            const MapTriangle &triangle = chunk.triangles[index];
+            const Vec3 &a = triangle.p0;
+            Vec3 b = triangle.p1;
+            Vec3 c = triangle.p2;
+            float area = PGK_Math::edgeFunction(a, b, c);
+            if (area == 0)
+                continue;
+            if (area < 0)
+            {
+                std::swap(b, c);
+                area = -area;
+            }
+            const float invArea = 1.0f / area;
+
+            const int minX = std::max(0, static_cast<int>(std::min({a.x, b.x, c.x})));
+            const int maxX = std::min(size - 1, static_cast<int>(std::max({a.x, b.x, c.x})));
+            const int minY = std::max(bandMinY, static_cast<int>(std::min({a.y, b.y, c.y})));
+            const int maxY = std::min(bandMaxY, static_cast<int>(std::max({a.y, b.y, c.y})));
+
+            // edge functions and z are stepped along the row, z is linear in screen space
+            // (1/depth for perspective faces)
+            const float w0dx = c.y - b.y, w1dx = a.y - c.y, w2dx = b.y - a.y;
+            const float zdx = (w0dx * a.z + w1dx * b.z + w2dx * c.z) * invArea;
+            for (int y = minY; y <= maxY; ++y)
+            {
+                const Vec3 p(minX + 0.5f, y + 0.5f, 0);
+                float w0 = PGK_Math::edgeFunction(b, c, p);
+                float w1 = PGK_Math::edgeFunction(c, a, p);
+                float w2 = PGK_Math::edgeFunction(a, b, p);
+                float z = (w0 * a.z + w1 * b.z + w2 * c.z) * invArea;
+
+                float *depthRow = &face.depth[y * size];
+                for (int x = minX; x <= maxX; ++x, w0 += w0dx, w1 += w1dx, w2 += w2dx, z += zdx)
+                {
+                    if (w0 < 0 || w1 < 0 || w2 < 0)
+                        continue;
+                    const float depth = perspective ? 1.0f / z : z;
+                    if (depth < depthRow[x])
+                        depthRow[x] = depth;
+                }
+            }
+        }
+    }
+}
+
+bool PGK_ShadowMap::project(const Face &face, const Vec3 &viewPos, float &x, float &y, float &depth) const
+{
+    depth = -viewPos.z;
+    float ndcX, ndcY;
+    if (perspective)
+    {
+        // clipped vertices can land a rounding error in front of the near plane
+        const float clampedDepth = std::max(depth, NEAR_CLIP);
+        ndcX = viewPos.x * face.scale / clampedDepth;
+        ndcY = viewPos.y * face.scale / clampedDepth;
+    }
+    else
+    {
+        ndcX = (viewPos.x - face.offsetX) * face.scale;
+        ndcY = (viewPos.y - face.offsetY) * face.scale;
+    }
+    x = (ndcX + 1.0f) * 0.5f * resolution;
+    y = (1.0f - ndcY) * 0.5f * resolution;
+    return !perspective || depth >= NEAR_CLIP;
+}
+
+const PGK_ShadowMap::Face &PGK_ShadowMap::selectFace(const Vec3 &surfacePos) const
+{
+    if (!cube)
+        return faces[0];
+
+    // the face whose axis is the major axis of the light to surface vector
+    const Vec3 d = surfacePos - lightPosition;
+    const float ax = std::abs(d.x), ay = std::abs(d.y), az = std::abs(d.z);
+    if (ax >= ay && ax >= az)
+        return faces[d.x > 0 ? 0 : 1];
+    if (ay >= az)
+        return faces[d.y > 0 ? 2 : 3];
+    return faces[d.z > 0 ? 4 : 5];
+}
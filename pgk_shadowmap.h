@@ -0,0 +1,63 @@
+#ifndef PGK_SHADOWMAP_H
+#define PGK_SHADOWMAP_H
+
+#include "pgk_math.h"
+
+#include <vector>
+
+class PGK_Light;
+
+// depth maps rendered from a light: one perspective face for a spot light, a cube of six
+// faces around a point light and one orthographic face for a directional light
+class PGK_ShadowMap
+{
+public:
+    // casterIndices holds three indices into the world space casterPositions per shadow casting triangle
+    void render(const PGK_Light &light, const std::vector<Vec3> &casterPositions, const std::vector<uint32_t> &casterIndices, uint32_t resolution);
+
+    // 0 when the surface is fully in shadow, 1 when fully lit, filtered over
+    // (2 * g_pgkCore.SHADOW_PCF_RADIUS + 1)^2 texels
+    float getLitFraction(const Vec3 &surfacePos, const Vec3 &normal) const;
+
+private:
+    static constexpr float NEAR_CLIP = 0.05f;
+    static constexpr int BAND_HEIGHT = 64;
+    static constexpr size_t SETUP_CHUNK_SIZE = 4096; // caster triangles per setup job
+
+    // caster triangle in texel coordinates, z is 1/depth for perspective faces and depth otherwise
+    struct MapTriangle
+    {
+        Vec3 p0, p1, p2;
+    };
+
+    // the triangles one setup job found on the map and, per band, the ones among them that touch it
+    struct SetupChunk
+    {
+        std::vector<MapTriangle> triangles;
+        std::vector<std::vector<uint32_t>> bands;
+    };
+
+    struct Face
+    {
+        Mat4 view;
+        float scale;            // view space to [-1, 1], 1/tan(fov/2) or 1/halfExtent
+        float offsetX, offsetY; // center of an orthographic face
+        std::vector<SetupChunk> chunks; // drawn in order, so the map doesn't depend on the thread count
+        std::vector<float> depth; // view space distance along the face axis, smaller is closer
+    };
+
+    void setupFaces(const PGK_Light &light, const std::vector<Vec3> &casterPositions);
+    void setupTriangles(Face &face, const std::vector<Vec3> &casterPositions, const std::vector<uint32_t> &casterIndices);
+    void rasterizeBand(Face &face, size_t band) const;
+    bool project(const Face &face, const Vec3 &viewPos, float &x, float &y, float &depth) const;
+    const Face &selectFace(const Vec3 &surfacePos) const;
+
+    std::vector<Face> faces;
+    std::vector<Vec3> viewPositions; // the caster positions in the view of the face being set up
+    bool perspective = true;
+    bool cube = false;
+    Vec3 lightPosition;
+    uint32_t resolution = 0;
+};
+
+#endif // PGK_SHADOWMAP_H
@@ -0,0 +1,356 @@
+#include "pgk_simplify.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <unordered_map>
+
+// squared distances to a set of planes, the symmetric 4x4 matrix of their equations summed. the
+// weight counts the planes, the error is their mean
+struct Quadric
+{
+    double xx = 0, xy = 0, xz = 0, xw = 0, yy = 0, yz = 0, yw = 0, zz = 0, zw = 0, ww = 0;
+    double weight = 0;
+
+    // the plane dot(normal, p) + d = 0, normal of unit length
+    static Quadric plane(const Vec3 &normal, float d)
+    {
+        Quadric q;
+        q.xx = double(normal.x) * normal.x;
+        q.xy = double(normal.x) * normal.y;
+        q.xz = double(normal.x) * normal.z;
+        q.xw = double(normal.x) * d;
+        q.yy = double(normal.y) * normal.y;
+        q.yz = double(normal.y) * normal.z;
+        q.yw = double(normal.y) * d;
+        q.zz = double(normal.z) * normal.z;
+        q.zw = double(normal.z) * d;
+        q.ww = double(d) * d;
+        q.weight = 1;
+        return q;
+    }
+
+    Quadric &operator+=(const Quadric &q)
+    {
+        xx += q.xx, xy += q.xy, xz += q.xz, xw += q.xw, yy += q.yy;
+        yz += q.yz, yw += q.yw, zz += q.zz, zw += q.zw, ww += q.ww;
+        weight += q.weight;
+        return *this;
+    }
+
+    double evaluate(const Vec3 &p) const
+    {
+        const double x = p.x, y = p.y, z = p.z;
+        const double error = x * x * xx + y * y * yy + z * z * zz + 2 * (x * y * xy + x * z * xz + y * z * yz + x * xw + y * yw + z * zw) + ww;
+        return weight > 0 ? std::max(error / weight, 0.0) : 0.0;
+    }
+};
+
+struct PositionKey
+{
+    uint32_t bits[3];
+
+    bool operator==(const PositionKey &other) const
+    {
+        return bits[0] == other.bits[0] && bits[1] == other.bits[1] && bits[2] == other.bits[2];
+    }
+};
+
+struct PositionKeyHash
+{
+    size_t operator()(const PositionKey &key) const
+    {
+        size_t hash = std::hash<uint32_t>()(key.bits[0]);
+        hash = hash * 31 + std::hash<uint32_t>()(key.bits[1]);
+        return hash * 31 + std::hash<uint32_t>()(key.bits[2]);
+    }
+};
+
+struct Collapse
+{
+    uint32_t from;
+    uint32_t to;
+    double error;
+};
+
+// compressed lists, the items of list i are items[start[i], start[i + 1])
+struct Adjacency
+{
+    std::vector<uint32_t> start;
+    std::vector<uint32_t> items;
+};
+
+static Vec3 triangleNormal(const Vec3 &a, const Vec3 &b, const Vec3 &c)
+{
+    return (b - a).cross(c - a);
+}
+
+std::vector<PGK_Simplify::Level> PGK_Simplify::simplify(const std::vector<Vertex> &vertices, const std::vector<unsigned int> &indices, const std::vector<size_t> &targetTriangleCounts)
+{
+    // vertices that only differ in their normal or uv share a position
+    std::vector<uint32_t> positionOf(vertices.size());
+    std::vector<Vec3> positions;
+    {
+        std::unordered_map<PositionKey, uint32_t, PositionKeyHash> positionIds;
+        for (size_t v = 0; v < vertices.size(); ++v)
+        {
+            PositionKey key;
+            std::memcpy(key.bits, &vertices[v].position, sizeof(key.bits));
+            const auto inserted = positionIds.emplace(key, static_cast<uint32_t>(positions.size()));
+            if (inserted.second)
+                positions.push_back(vertices[v].position);
+            positionOf[v] = inserted.first->second;
+        }
+    }
+    Adjacency positionVertices;
+    positionVertices.start.assign(positions.size() + 1, 0);
+    for (const uint32_t position : positionOf)
+    {
+        positionVertices.start[position + 1]++;
+    }
+    for (size_t p = 0; p < positions.size(); ++p)
+    {
+        positionVertices.start[p + 1] += positionVertices.start[p];
+    }
+    positionVertices.items.resize(vertices.size());
+    {
+        std::vector<uint32_t> fill(positionVertices.start.begin(), positionVertices.start.end() - 1);
+        for (size_t v = 0; v < vertices.size(); ++v)
+        {
+            positionVertices.items[fill[positionOf[v]]++] = static_cast<uint32_t>(v);
+        }
+    }
+
+    // the current vertex of every triangle corner, triangles that lost their area are dropped
+    const size_t triangleCount = indices.size() / 3;
+    std::vector<unsigned int> corners(indices.begin(), indices.begin() + triangleCount * 3);
+    std::vector<char> live(triangleCount, 1);
+    size_t liveCount = 0;
+    const auto cornerPosition = [&](size_t t, int k) { return positionOf[corners[t * 3 + k]]; };
+    const auto isDegenerate = [&](size_t t)
+    {
+        return cornerPosition(t, 0) == cornerPosition(t, 1) || cornerPosition(t, 1) == cornerPosition(t, 2) || cornerPosition(t, 0) == cornerPosition(t, 2);
+    };
+
+    // the planes of the triangles around every position. open edges add a plane through the edge
+    // perpendicular to their triangle, which keeps borders from shrinking
+    std::vector<Quadric> quadrics(positions.size());
+    std::unordered_map<uint64_t, std::pair<uint32_t, uint32_t>> edgeUse; // triangle count and the last triangle
+    for (size_t t = 0; t < triangleCount; ++t)
+    {
+        if (isDegenerate(t))
+        {
+            live[t] = 0;
+            continue;
+        }
+        liveCount++;
+        const Vec3 &a = positions[cornerPosition(t, 0)];
+        const Vec3 normal = triangleNormal(a, positions[cornerPosition(t, 1)], positions[cornerPosition(t, 2)]);
+        const float length = normal.length();
+        if (length > 0)
+        {
+            const Vec3 unit = normal / length;
+            const Quadric plane = Quadric::plane(unit, -unit.dot(a));
+            for (int k = 0; k < 3; ++k)
+            {
+                quadrics[cornerPosition(t, k)] += plane;
+            }
+        }
+        for (int k = 0; k < 3; ++k)
+        {
+            const uint32_t p0 = cornerPosition(t, k);
+            const uint32_t p1 = cornerPosition(t, (k + 1) % 3);
+            auto &use = edgeUse[uint64_t(std::min(p0, p1)) << 32 | std::max(p0, p1)];
+            use.first++;
+            use.second = static_cast<uint32_t>(t);
+        }
+    }
+    for (const auto &edge : edgeUse)
+    {
+        if (edge.second.first != 1)
+            continue;
+        const uint32_t p0 = static_cast<uint32_t>(edge.first >> 32);
+        const uint32_t p1 = static_cast<uint32_t>(edge.first & 0xffffffff);
+        const size_t t = edge.second.second;
+        const Vec3 normal = triangleNormal(positions[cornerPosition(t, 0)], positions[cornerPosition(t, 1)], positions[cornerPosition(t, 2)]);
+        const Vec3 border = (positions[p1] - positions[p0]).cross(normal);
+        const float length = border.length();
+        if (length <= 0)
+            continue;
+        const Vec3 unit = border / length;
+        const Quadric plane = Quadric::plane(unit, -unit.dot(positions[p0]));
+        quadrics[p0] += plane;
+        quadrics[p1] += plane;
+    }
+
+    std::vector<Level> levels;
+    size_t nextTarget = 0;
+    float error = 0;
+    Adjacency positionTriangles;
+    std::vector<uint64_t> edges;
+    std::vector<Collapse> collapses;
+    std::vector<char> locked(positions.size());
+    while (nextTarget < targetTriangleCounts.size())
+    {
+        const size_t target = targetTriangleCounts[nextTarget];
+        if (liveCount <= target)
+        {
+            Level level;
+            level.error = error;
+            for (size_t t = 0; t < triangleCount; ++t)
+            {
+                if (live[t])
+                    level.indices.insert(level.indices.end(), corners.begin() + t * 3, corners.begin() + t * 3 + 3);
+            }
+            levels.push_back(std::move(level));
+            nextTarget++;
+            continue;
+        }
+
+        // a pass collapses the cheapest edges first. the triangles around a collapsed position are
+        // locked for the rest of the pass, so the costs and adjacency of the others stay valid
+        positionTriangles.start.assign(positions.size() + 1, 0);
+        edges.clear();
+        for (size_t t = 0; t < triangleCount; ++t)
+        {
+            if (!live[t])
+                continue;
+            for (int k = 0; k < 3; ++k)
+            {
+                const uint32_t p0 = cornerPosition(t, k);
+                const uint32_t p1 = cornerPosition(t, (k + 1) % 3);
+                positionTriangles.start[p0 + 1]++;
+                edges.push_back(uint64_t(std::min(p0, p1)) << 32 | std::max(p0, p1));
+            }
+        }
+        for (size_t p = 0; p < positions.size(); ++p)
+        {
+            positionTriangles.start[p + 1] += positionTriangles.start[p];
+        }
+        positionTriangles.items.resize(positionTriangles.start.back());
+        {
+            std::vector<uint32_t> fill(positionTriangles.start.begin(), positionTriangles.start.end() - 1);
+            for (size_t t = 0; t < triangleCount; ++t)
+            {
+                if (!live[t])
+                    continue;
+                for (int k = 0; k < 3; ++k)
+                {
+                    positionTriangles.items[fill[cornerPosition(t, k)]++] = static_cast<uint32_t>(t);
+                }
+            }
+        }
+        std::sort(edges.begin(), edges.end());
+        edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+        collapses.clear();
+        for (const uint64_t edge : edges)
+        {
+            const uint32_t p0 = static_cast<uint32_t>(edge >> 32);
+            const uint32_t p1 = static_cast<uint32_t>(edge & 0xffffffff);
+            Quadric combined = quadrics[p0];
+            combined += quadrics[p1];
+            const double error0 = combined.evaluate(positions[p0]);
+            const double error1 = combined.evaluate(positions[p1]);
+            collapses.push_back(error0 < error1 ? Collapse{p1, p0, error0} : Collapse{p0, p1, error1});
+        }
+        std::sort(collapses.begin(), collapses.end(), [](const Collapse &a, const Collapse &b) { return a.error < b.error; });
+
+        std::fill(locked.begin(), locked.end(), 0);
+        size_t collapsed = 0;
+        for (const Collapse &collapse : collapses)
+        {
+            if (liveCount <= target)
+                break;
+            if (locked[collapse.from] || locked[collapse.to])
+                continue;
+
+            // rejected when a remaining triangle around it would turn over
+            bool flips = false;
+            for (uint32_t i = positionTriangles.start[collapse.from]; i < positionTriangles.start[collapse.from + 1] && !flips; ++i)
+            {
+                const uint32_t t = positionTriangles.items[i];
+                Vec3 before[3], after[3];
+                bool removed = false;
+                for (int k = 0; k < 3; ++k)
+                {
+                    const uint32_t position = cornerPosition(t, k);
+                    removed |= position == collapse.to;
+                    before[k] = positions[position];
+                    after[k] = positions[position == collapse.from ? collapse.to : position];
+                }
+                if (!removed)
+                    flips = triangleNormal(before[0], before[1], before[2]).dot(triangleNormal(after[0], after[1], after[2])) <= 0;
+            }
+            if (flips)
+                continue;
+
+            for (uint32_t i = positionTriangles.start[collapse.from]; i < positionTriangles.start[collapse.from + 1]; ++i)
+            {
+                const uint32_t t = positionTriangles.items[i];
+                for (int k = 0; k < 3; ++k)
+                {
+                    locked[cornerPosition(t, k)] = 1;
+                }
+            }
+
+            // every vertex moves onto the vertex it shares an edge with, so its attributes carry
+            // over across the collapsed edge. one without such an edge takes the closest attributes
+            for (uint32_t i = positionTriangles.start[collapse.from]; i < positionTriangles.start[collapse.from + 1]; ++i)
+            {
+                const uint32_t t = positionTriangles.items[i];
+                for (int k = 0; k < 3; ++k)
+                {
+                    if (cornerPosition(t, k) != collapse.from)
+                        continue;
+                    const unsigned int vertex = corners[t * 3 + k];
+                    unsigned int partner = std::numeric_limits<unsigned int>::max();
+                    for (uint32_t j = positionTriangles.start[collapse.from]; j < positionTriangles.start[collapse.from + 1] && partner == std::numeric_limits<unsigned int>::max(); ++j)
+                    {
+                        const uint32_t other = positionTriangles.items[j];
+                        const unsigned int *otherCorners = &corners[other * 3];
+                        if (otherCorners[0] != vertex && otherCorners[1] != vertex && otherCorners[2] != vertex)
+                            continue;
+                        for (int c = 0; c < 3; ++c)
+                        {
+                            if (positionOf[otherCorners[c]] == collapse.to)
+                                partner = otherCorners[c];
+                        }
+                    }
+                    if (partner == std::numeric_limits<unsigned int>::max())
+                    {
+                        float closest = std::numeric_limits<float>::max();
+                        for (uint32_t j = positionVertices.start[collapse.to]; j < positionVertices.start[collapse.to + 1]; ++j)
+                        {
+                            const Vertex &candidate = vertices[positionVertices.items[j]];
+                            const float distance = candidate.normal.distanceSq(vertices[vertex].normal) + candidate.texCoord.distanceSq(vertices[vertex].texCoord);
+                            if (distance < closest)
+                            {
+                                closest = distance;
+                                partner = positionVertices.items[j];
+                            }
+                        }
+                    }
+                    corners[t * 3 + k] = partner;
+                }
+            }
+            for (uint32_t i = positionTriangles.start[collapse.from]; i < positionTriangles.start[collapse.from + 1]; ++i)
+            {
+                const uint32_t t = positionTriangles.items[i];
+                if (live[t] && isDegenerate(t))
+                {
+                    live[t] = 0;
+                    liveCount--;
+                }
+            }
+
+            quadrics[collapse.to] += quadrics[collapse.from];
+            error = std::max(error, static_cast<float>(std::sqrt(collapse.error)));
+            collapsed++;
+        }
+        if (collapsed == 0)
+            break;
+    }
+    return levels;
+}
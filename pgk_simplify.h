@@ -0,0 +1,24 @@
+#ifndef PGK_SIMPLIFY_H
+#define PGK_SIMPLIFY_H
+
+#include "pgk_obj.h"
+
+#include <vector>
+
+// mesh simplification by edge collapses ordered by their quadric error. a collapse moves every
+// vertex of one position onto a vertex at a neighbouring position, so the results index the
+// original vertices and positions are welded, attribute seams don't open up
+namespace PGK_Simplify
+{
+    struct Level
+    {
+        std::vector<unsigned int> indices;
+        float error; // about how far the surface moved in object space, estimated from the quadrics
+    };
+
+    // one level per target triangle count, targets in decreasing order. levels the mesh can't be
+    // reduced to are left out
+    std::vector<Level> simplify(const std::vector<Vertex> &vertices, const std::vector<unsigned int> &indices, const std::vector<size_t> &targetTriangleCounts);
+};
+
+#endif // PGK_SIMPLIFY_H
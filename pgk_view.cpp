@@ -14,6 +14,29 @@ PGK_View::PGK_View(QWidget *parent) : QWidget(parent)
 
     _zbuffer = std::vector<float>(resWidth*resHeight,std::numeric_limits<float>::lowest());
     _emptyZbuffer = std::vector<float>(resWidth*resHeight,std::numeric_limits<float>::lowest());
+    if (g_pgkCore.DEFERRED_SHADING)
+        _visibilityBuffer = std::vector<VisibilitySample>(resWidth*resHeight);
+
+    // screen tiles, each one is rasterized by a single worker
+    // and owns whole depth blocks, so the size is a multiple of DepthBlock::SIZE
+    tileSize = std::max<int>(DepthBlock::SIZE, (g_pgkCore.TILE_SIZE + DepthBlock::SIZE - 1) / DepthBlock::SIZE * DepthBlock::SIZE);
+    tilesX = (resWidth + tileSize - 1) / tileSize;
+    tilesY = (resHeight + tileSize - 1) / tileSize;
+    tiles.resize(tilesX * tilesY);
+    for (int ty = 0; ty < tilesY; ++ty)
+    {
+        for (int tx = 0; tx < tilesX; ++tx)
+        {
+            Tile &tile = tiles[tx + ty * tilesX];
+            tile.minX = tx * tileSize;
+            tile.minY = ty * tileSize;
+            tile.maxX = std::min(tile.minX + tileSize, resWidth) - 1;
+            tile.maxY = std::min(tile.minY + tileSize, resHeight) - 1;
+            tile.blocksX = (tile.maxX - tile.minX + DepthBlock::SIZE) / DepthBlock::SIZE;
+            const int blocksY = (tile.maxY - tile.minY + DepthBlock::SIZE) / DepthBlock::SIZE;
+            tile.depthBlocks.resize(tile.blocksX * blocksY);
+        }
+    }
 
     canvas = QImage(resWidth, resHeight, QImage::Format_RGB32);
     this->resize(resWidth,resHeight);
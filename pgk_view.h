@@ -6,6 +6,35 @@
 #include <QWidget>
 #include <QHBoxLayout>
 
+// depth range of an 8x8 pixel block, larger z is closer to the camera
+struct DepthBlock
+{
+    static constexpr int SIZE = 8;
+    float minDepth;
+    float maxDepth;
+};
+
+// visibility buffer entry, the triangle that won the depth test and where it was hit
+struct VisibilitySample
+{
+    static constexpr uint32_t NO_TRIANGLE = UINT32_MAX;
+    uint32_t triangle;
+    float alpha;
+    float beta;
+};
+
+struct Tile
+{
+    int minX, minY, maxX, maxY;
+    std::vector<uint32_t> triangles;
+    std::vector<uint32_t> lights; // indices of the lights that can reach the tile
+
+    // hierarchical depth: the whole tile, then its 8x8 blocks
+    float minDepth;
+    int blocksX;
+    std::vector<DepthBlock> depthBlocks;
+};
+
 class PGK_View : public QWidget
 {
     Q_OBJECT
@@ -26,6 +55,11 @@ public:
     bool scalable = false;
     std::vector<float> _zbuffer;
     std::vector<float> _emptyZbuffer;
+    std::vector<VisibilitySample> _visibilityBuffer;
+    std::vector<Tile> tiles;
+    int tileSize;
+    int tilesX;
+    int tilesY;
 
     void lockMouse() {
         setCursor(Qt::BlankCursor);